@@ -0,0 +1,338 @@
+/*
+Cost of the DSP components on their own, without a running Rack: every
+component processes a noise signal at 44.1, 48, 96 and 192 kHz, and the
+time per sample is written as JSON so that builds can be compared.
+
+    make bench/components
+    bench/components [samples] [output.json]
+
+Without an output file the JSON goes to stdout. Parameters that are
+modulated are set every sample, or every RAMP samples for the filters that
+ramp their coefficients.
+*/
+#include "plugin.hpp"
+
+#include "components/simple_svf.hpp"
+#include "components/diffusion_stage.hpp"
+#include "components/matrix_mixer.hpp"
+#include "components/matched_biquad.hpp"
+#include "components/matched_shelving.hpp"
+// Defines the macros N and reso, so it comes last.
+#include "components/bandlimited_oscillator.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using simd::float_4;
+
+
+typedef std::chrono::steady_clock Clock;
+
+static const float SAMPLE_RATES[] = {44100.f, 48000.f, 96000.f, 192000.f};
+static const unsigned RAMP = 16;
+static const unsigned NOISE_LENGTH = 4096;
+
+// Results are summed into it so that the work is not optimized away.
+static volatile float sink;
+
+struct Bench {
+	unsigned samples;
+	float FS;
+	std::vector<float> noise;
+	json_t* results;
+
+	Bench(unsigned samples, json_t* results)
+	: samples(samples), FS(48000.f), noise(NOISE_LENGTH), results(results)
+	{
+		uint32_t seed = 1;
+		for(float& x : noise){
+			seed = seed*1664525u + 1013904223u;
+			x = (seed >> 8)*(2.f/(1 << 24)) - 1.f;
+		}
+	}
+
+	float in(unsigned i)
+	{
+		return noise[i & (NOISE_LENGTH - 1)];
+	}
+
+	float_4 in4(unsigned i)
+	{
+		return float_4::load(&noise[i & (NOISE_LENGTH - 4)]);
+	}
+
+	// Runs process(i) for a warm up and then for the measured samples.
+	template <typename F>
+	void run(char const* component, char const* variant, F process)
+	{
+		float sum = 0.f;
+		for(unsigned i = 0; i < samples/8; i++){
+			sum += process(i);
+		}
+		Clock::time_point begin = Clock::now();
+		for(unsigned i = 0; i < samples; i++){
+			sum += process(i);
+		}
+		Clock::time_point end = Clock::now();
+		sink = sink + sum;
+
+		double ns = std::chrono::duration<double, std::nano>(end - begin).count()/samples;
+		json_t* result = json_object();
+		json_object_set_new(result, "component", json_string(component));
+		json_object_set_new(result, "variant", json_string(variant));
+		json_object_set_new(result, "sample_rate", json_real(FS));
+		json_object_set_new(result, "ns_per_sample", json_real(ns));
+		json_array_append_new(results, result);
+		std::fprintf(stderr, "%-16s %-24s %6.0f Hz %9.2f ns/sample\n", component, variant, FS, ns);
+	}
+};
+
+static float sum4(float_4 v)
+{
+	return v[0] + v[1] + v[2] + v[3];
+}
+
+// A cutoff sweeping 100 Hz to 6.4 kHz and back every 4096 samples.
+static float_4 sweep(unsigned i)
+{
+	float x = (float)(i & 4095)/2048.f;
+	return float_4(100.f)*dsp::approxExp2_taylor5(float_4(6.f*(x < 1.f ? x : 2.f - x)));
+}
+
+static void benchSvf(Bench& b)
+{
+	cs::SimpleSvf<float_4> svf(b.FS);
+	svf.setParams(float_4(1000.f), float_4(2.f));
+	b.run("SimpleSvf", "static", [&](unsigned i){
+		return sum4(svf.process(b.in4(i)));
+	});
+	b.run("SimpleSvf", "modulated", [&](unsigned i){
+		svf.setParams(sweep(i), float_4(2.f));
+		return sum4(svf.process(b.in4(i)));
+	});
+}
+
+static void benchAllpass(Bench& b)
+{
+	char variant[32];
+	for(unsigned depth = 1; depth <= 256; depth *= 2){
+		cs::SeriesAllpass<float_4, 256> chain(b.FS);
+		chain.setParams(float_4(1000.f), float_4(2.f), 2.f, depth);
+		std::snprintf(variant, sizeof(variant), "depth %u", depth);
+		b.run("SeriesAllpass", variant, [&](unsigned i){
+			chain.process(b.in4(i));
+			return sum4(chain.getAllPass());
+		});
+	}
+	cs::SeriesAllpass<float_4, 256> chain(b.FS);
+	b.run("SeriesAllpass", "depth 256, modulated", [&](unsigned i){
+		chain.setParams(sweep(i), float_4(2.f), 2.f, 256);
+		chain.process(b.in4(i));
+		return sum4(chain.getAllPass());
+	});
+	b.run("SeriesAllpass", "depth 256, ramped", [&](unsigned i){
+		if(i % RAMP == 0){
+			chain.rampParams(sweep(i), float_4(2.f), 2.f, 256, 0, RAMP);
+		}
+		chain.process(b.in4(i));
+		return sum4(chain.getAllPass());
+	});
+	b.run("SeriesAllpass", "depth 256, ramped, 0 oct", [&](unsigned i){
+		if(i % RAMP == 0){
+			chain.rampParams(sweep(i), float_4(2.f), 0.f, 256, 0, RAMP);
+		}
+		chain.process(b.in4(i));
+		return sum4(chain.getAllPass());
+	});
+	cs::SeriesAllpass<float_4, 256, 4> banks(b.FS);
+	for(unsigned bank = 0; bank < 4; bank++){
+		banks.setParams(float_4(1000.f), float_4(2.f), 2.f, 256, bank);
+	}
+	b.run("SeriesAllpass", "depth 256, 4 banks", [&](unsigned i){
+		float_4 in[4] = {b.in4(i), b.in4(i + 4), b.in4(i + 8), b.in4(i + 12)};
+		banks.process(in, 4);
+		return sum4(banks.getAllPass(0) + banks.getAllPass(3));
+	});
+}
+
+template <unsigned CHANNELS>
+static void benchDiffusion(Bench& b, char const* component)
+{
+	static const unsigned GROUPS = CHANNELS/4;
+	float_4 lengths[GROUPS];
+	float_4 normal[GROUPS];
+	for(unsigned g = 0; g < GROUPS; g++){
+		lengths[g] = float_4(0.011f, 0.017f, 0.023f, 0.031f) + float_4(0.004f*g);
+		normal[g] = float_4(1.f);
+	}
+	cs::DelayArena arena(cs::DelayStage<CHANNELS>::arenaRows(lengths, b.FS));
+	char const* mixers[2] = {"householder", "hadamard"};
+	char variant[32];
+	for(unsigned m = 0; m < 2; m++){
+		arena.reset();
+		cs::DiffusionStage<CHANNELS> stage(lengths, normal, b.FS, arena, (cs::MixerType)m);
+		stage.setScale(1.f);
+		float_4 v[GROUPS];
+		std::snprintf(variant, sizeof(variant), "%s", mixers[m]);
+		b.run(component, variant, [&](unsigned i){
+			for(unsigned g = 0; g < GROUPS; g++){
+				v[g] = b.in4(i + 4*g);
+			}
+			stage.process(v);
+			return sum4(v[0]);
+		});
+		// The size changes every grain, so both grains are read.
+		std::snprintf(variant, sizeof(variant), "%s, gliding", mixers[m]);
+		b.run(component, variant, [&](unsigned i){
+			stage.setScale(0.5f + (float)(i & 1023)/2048.f);
+			for(unsigned g = 0; g < GROUPS; g++){
+				v[g] = b.in4(i + 4*g);
+			}
+			stage.process(v);
+			return sum4(v[0]);
+		});
+	}
+}
+
+template <unsigned CHANNELS>
+static void benchMixers(Bench& b, char const* component)
+{
+	static const unsigned GROUPS = CHANNELS/4;
+	float_4 normal[GROUPS];
+	for(unsigned g = 0; g < GROUPS; g++){
+		normal[g] = float_4(1.f, -1.f, 1.f, 1.f);
+	}
+	cs::HouseholderMixer<CHANNELS> householder(normal);
+	float_4 v[GROUPS];
+	for(unsigned g = 0; g < GROUPS; g++){
+		v[g] = b.in4(4*g);
+	}
+	b.run(component, "householder", [&](unsigned i){
+		v[0] += b.in4(i);
+		householder.process(v);
+		return sum4(v[GROUPS - 1]);
+	});
+	b.run(component, "hadamard", [&](unsigned i){
+		v[0] += b.in4(i);
+		cs::HadamardMixer<CHANNELS>::process(v);
+		return sum4(v[GROUPS - 1]);
+	});
+}
+
+static void benchOscillators(Bench& b)
+{
+	// One discontinuity every 100 samples, about what a 480 Hz saw adds at 48 kHz.
+	cs::CorrectionBuffer correction;
+	b.run("CorrectionBuffer", "blep every 100 samples", [&](unsigned i){
+		if(i % 100 == 0){
+			correction.addDiscontinuity(0.5f + 0.4f*b.in(i), 2.f, cs::FIRST_ORDER);
+		}
+		return correction.timeStep();
+	});
+
+	cs::Saw saw;
+	saw.setSampleTime(1.f/b.FS);
+	saw.setFrequency(440.f);
+	b.run("Saw", "440 Hz", [&](unsigned i){
+		return saw.process();
+	});
+	b.run("Saw", "440 Hz, synced at 293 Hz", [&](unsigned i){
+		if(i % (unsigned)(b.FS/293.f) == 0){
+			saw.sync(0.5f);
+		}
+		return saw.process();
+	});
+
+	cs::Triangle triangle;
+	triangle.setSampleTime(1.f/b.FS);
+	triangle.setFrequency(440.f);
+	b.run("Triangle", "440 Hz", [&](unsigned i){
+		return triangle.process();
+	});
+}
+
+// Filters with setParams(frequency, x) and rampParams(frequency, x, steps).
+template <typename F>
+static void benchFilter(Bench& b, char const* component, float_4 x)
+{
+	F filter(b.FS);
+	filter.setParams(float_4(1000.f), x);
+	b.run(component, "static", [&](unsigned i){
+		return sum4(filter.process(b.in4(i)));
+	});
+	b.run(component, "modulated", [&](unsigned i){
+		filter.setParams(sweep(i), x);
+		return sum4(filter.process(b.in4(i)));
+	});
+	b.run(component, "ramped", [&](unsigned i){
+		if(i % RAMP == 0){
+			filter.rampParams(sweep(i), x, RAMP);
+		}
+		return sum4(filter.process(b.in4(i)));
+	});
+}
+
+static void benchShelves(Bench& b)
+{
+	cs::TwoShelves<float_4> shelves(b.FS);
+	shelves.setParams(float_4(1000.f), float_4(1.f), float_4(0.25f));
+	b.run("TwoShelves", "static", [&](unsigned i){
+		return sum4(shelves.process(b.in4(i)));
+	});
+	b.run("TwoShelves", "modulated", [&](unsigned i){
+		shelves.setParams(sweep(i), float_4(1.f), float_4(0.25f));
+		return sum4(shelves.process(b.in4(i)));
+	});
+	b.run("TwoShelves", "ramped", [&](unsigned i){
+		if(i % RAMP == 0){
+			shelves.rampParams(sweep(i), float_4(1.f), float_4(0.25f), RAMP);
+		}
+		return sum4(shelves.process(b.in4(i)));
+	});
+}
+
+int main(int argc, char** argv)
+{
+	unsigned samples = argc > 1 ? std::atoi(argv[1]) : 1 << 18;
+	char const* path = argc > 2 ? argv[2] : nullptr;
+
+	json_t* rootJ = json_object();
+	json_t* results = json_array();
+	json_object_set_new(rootJ, "samples", json_integer(samples));
+	json_object_set_new(rootJ, "results", results);
+
+	Bench b(samples, results);
+	for(float FS : SAMPLE_RATES){
+		b.FS = FS;
+		benchSvf(b);
+		benchAllpass(b);
+		benchDiffusion<4>(b, "DiffusionStage4");
+		benchDiffusion<8>(b, "DiffusionStage8");
+		benchDiffusion<16>(b, "DiffusionStage16");
+		benchMixers<4>(b, "Mixer4");
+		benchMixers<16>(b, "Mixer16");
+		benchOscillators(b);
+		benchFilter<cs::LowPass<float_4>>(b, "LowPass", float_4(2.f));
+		benchFilter<cs::HighPass<float_4>>(b, "HighPass", float_4(2.f));
+		benchFilter<cs::HighShelf<float_4>>(b, "HighShelf", float_4(0.5f));
+		benchFilter<cs::Tilting<float_4>>(b, "Tilting", float_4(0.5f));
+		benchShelves(b);
+	}
+
+	int flags = JSON_INDENT(2) | JSON_REAL_PRECISION(6);
+	if(path){
+		if(json_dump_file(rootJ, path, flags) != 0){
+			std::fprintf(stderr, "could not write %s\n", path);
+			json_decref(rootJ);
+			return 1;
+		}
+	}
+	else{
+		json_dumpf(rootJ, stdout, flags);
+		std::printf("\n");
+	}
+	json_decref(rootJ);
+	return 0;
+}
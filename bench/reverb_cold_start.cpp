@@ -0,0 +1,129 @@
+/*
+Cold start of the Reverb: creates a number of modules the way loading a
+patch does (construction, sample rate, patch data), then processes them in
+real time until every one plays the network its worker built, and finally
+times the first samples with the networks running. Each step is reported.
+
+    make bench/reverb_cold_start
+    bench/reverb_cold_start [modules] [samples] [sample rate]
+
+Run it from the plugin directory, the models are read from
+src/reverb_constants.json.
+*/
+#include "plugin.hpp"
+#include "reverb_send.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+typedef std::chrono::steady_clock Clock;
+
+// Samples processed between checks while waiting for the networks.
+static constexpr unsigned WAIT_BLOCK = 64;
+
+static double milliseconds(Clock::time_point begin, Clock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+// The bench only sees the Reverb as a Module, its inputs are found by name.
+static Input& findInput(Module* module, std::string const& name)
+{
+	for(size_t i = 0; i < module->inputInfos.size(); i++){
+		if(module->inputInfos[i] && module->inputInfos[i]->name == name){
+			return module->inputs[i];
+		}
+	}
+	std::fprintf(stderr, "no input named %s\n", name.c_str());
+	std::exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned modules = argc > 1 ? std::atoi(argv[1]) : 16;
+	unsigned samples = argc > 2 ? std::atoi(argv[2]) : 4800;
+	float FS = argc > 3 ? std::atof(argv[3]) : 48000.f;
+
+	Clock::time_point begin = Clock::now();
+	Plugin* plugin = new Plugin;
+	plugin->path = ".";
+	init(plugin);
+
+	Clock::time_point loaded = Clock::now();
+	std::vector<Module*> reverbs;
+	std::vector<Input*> left_inputs;
+	std::vector<Input*> right_inputs;
+	for(unsigned i = 0; i < modules; i++){
+		Module* module = modelReverb->createModule();
+		Module::SampleRateChangeEvent e;
+		e.sampleRate = FS;
+		e.sampleTime = 1.f/FS;
+		module->onSampleRateChange(e);
+		json_t* data = module->dataToJson();
+		module->dataFromJson(data);
+		json_decref(data);
+		for(Input& input : module->inputs){
+			input.setChannels(1);
+		}
+		for(Output& output : module->outputs){
+			output.setChannels(1);
+		}
+		reverbs.push_back(module);
+		left_inputs.push_back(&findInput(module, "Left"));
+		right_inputs.push_back(&findInput(module, "Right"));
+	}
+
+	Module::ProcessArgs args;
+	args.sampleRate = FS;
+	args.sampleTime = 1.f/FS;
+	args.frame = 0;
+	// A click every 100 ms on both inputs keeps the modules from sleeping.
+	unsigned click_period = std::max(1u, (unsigned)(0.1f*FS));
+	auto processAll = [&](unsigned count){
+		for(unsigned i = 0; i < count; i++){
+			float in = (args.frame % click_period == 0) ? 5.f : 0.f;
+			for(unsigned m = 0; m < modules; m++){
+				left_inputs[m]->setVoltage(in);
+				right_inputs[m]->setVoltage(in);
+				reverbs[m]->process(args);
+			}
+			args.frame++;
+		}
+	};
+
+	// The networks are built by the workers once the modules process audio,
+	// the engine keeps running them dry meanwhile, at the host's pace.
+	Clock::time_point created = Clock::now();
+	unsigned waiting = modules;
+	while(waiting){
+		processAll(WAIT_BLOCK);
+		waiting = 0;
+		for(Module* module : reverbs){
+			waiting += reverbNetworkReady(module) ? 0 : 1;
+		}
+		std::this_thread::sleep_until(created + std::chrono::duration<double>(args.frame/FS));
+	}
+	Clock::time_point ready = Clock::now();
+	int64_t dry_samples = args.frame;
+
+	processAll(samples);
+	Clock::time_point processed = Clock::now();
+	for(Module* module : reverbs){
+		delete module;
+	}
+	Clock::time_point destroyed = Clock::now();
+
+	std::printf("plugin init        %10.3f ms\n", milliseconds(begin, loaded));
+	std::printf("create %4u        %10.3f ms\n", modules, milliseconds(loaded, created));
+	std::printf("networks ready     %10.3f ms (%lld samples dry)\n", milliseconds(created, ready), (long long)dry_samples);
+	std::printf("next %7u samples %9.3f ms (%.2f x realtime)\n", samples, milliseconds(ready, processed),
+		1000.f*samples/FS/milliseconds(ready, processed));
+	std::printf("destroy            %10.3f ms\n", milliseconds(processed, destroyed));
+	return 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "rack.hpp"
+
+#include <algorithm>
+
+namespace cs{
+
+/*
+Rack's 16 polyphonic channels as float_4 banks, channels 4*b to 4*b+3 in
+bank b. Only the banks holding an active channel are processed. Like Rack's
+outputs there is always at least one channel, so a module with nothing
+patched still runs its first bank.
+*/
+static constexpr unsigned MAX_CHANNELS = 16;
+static constexpr unsigned MAX_CHANNEL_BANKS = MAX_CHANNELS/4;
+
+inline unsigned clampChannels(unsigned channels)
+{
+    return std::max(1u, std::min(channels, MAX_CHANNELS));
+}
+
+// Number of banks holding the first `channels` channels.
+inline unsigned channelBanks(unsigned channels)
+{
+    return (clampChannels(channels) + 3)/4;
+}
+
+/*
+One float_4 instance of a component per bank. A bank that comes back into
+use starts over from a copy of the prototype rather than from the state it
+was left in, so no stale tail or phase leaks into a new voice.
+*/
+template <typename C>
+struct ChannelBank{
+private:
+    C prototype;
+    C banks[MAX_CHANNEL_BANKS];
+    unsigned channels = 0;
+    unsigned active = 0;
+
+public:
+    ChannelBank(C const& prototype = C())
+    : prototype(prototype),
+      banks{prototype, prototype, prototype, prototype}
+    {
+        static_assert(MAX_CHANNEL_BANKS == 4, "one prototype copy per bank");
+    }
+
+    // Returns the number of banks to process.
+    unsigned setChannels(unsigned new_channels)
+    {
+        unsigned new_active = channelBanks(new_channels);
+        for(unsigned b = active; b < new_active; b++){
+            banks[b] = prototype;
+        }
+        channels = clampChannels(new_channels);
+        active = new_active;
+        return active;
+    }
+
+    unsigned getChannels(void)
+    {
+        return channels;
+    }
+
+    unsigned getBanks(void)
+    {
+        return active;
+    }
+
+    C& operator[](unsigned bank)
+    {
+        return banks[bank];
+    }
+};
+
+}
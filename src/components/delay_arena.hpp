@@ -0,0 +1,74 @@
+#pragma once
+
+#include "rack.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace cs{
+
+/*
+Backing memory for delay lines. The lines of a processor are carved out of
+one contiguous block, each slice starting on a cache line. Rebuilding the
+lines only rewinds the arena, so it does not touch the heap as long as the
+arena was reserved large enough beforehand.
+*/
+struct DelayArena{
+private:
+    static constexpr size_t CACHE_LINE = 64;
+    static constexpr size_t ROWS_PER_LINE = CACHE_LINE / sizeof(simd::float_4);
+
+    std::vector<simd::float_4> storage;
+    simd::float_4* base = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+
+public:
+    DelayArena(size_t rows = 0)
+    {
+        reserve(rows);
+    }
+
+    DelayArena(DelayArena const&) = delete;
+    DelayArena& operator=(DelayArena const&) = delete;
+
+    static size_t roundUp(size_t rows)
+    {
+        return (rows + ROWS_PER_LINE - 1) / ROWS_PER_LINE * ROWS_PER_LINE;
+    }
+
+    // Grows the arena to at least `rows` rows. Growing invalidates all slices.
+    void reserve(size_t rows)
+    {
+        rows = roundUp(rows);
+        if(rows <= capacity) return;
+        storage = std::vector<simd::float_4>(rows + ROWS_PER_LINE - 1);
+        uintptr_t address = (uintptr_t)storage.data();
+        base = (simd::float_4*)((address + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+        capacity = rows;
+        used = 0;
+    }
+
+    // Forgets all slices, their memory is handed out again by take().
+    void reset(void)
+    {
+        used = 0;
+    }
+
+    // Zeroed, cache line aligned slice of `rows` rows. The arena must have
+    // been reserved for the sum of all slices taken since the last reset.
+    simd::float_4* take(size_t rows)
+    {
+        rows = roundUp(rows);
+        simd::float_4* slice = base + used;
+        used += rows;
+        std::fill(slice, slice + rows, simd::float_4::zero());
+        return slice;
+    }
+
+    size_t size(void) const
+    {
+        return capacity;
+    }
+};
+
+}
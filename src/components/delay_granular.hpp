@@ -1,58 +1,180 @@
 #pragma once
 
 #include "rack.hpp"
-#include <vector>
+
+#include "delay_arena.hpp"
+
+#include <algorithm>
 
 namespace cs{
 
-struct Delay2H{
+inline simd::float_4 laneMask(int lane)
+{
+    return simd::float_4(0.f, 1.f, 2.f, 3.f) == simd::float_4((float)lane);
+}
+
+// Ring rows read by four heads at the given delays (relative to capacity).
+inline simd::int32_4 delayRows(simd::float_4 delay, simd::float_4 capacity, unsigned write_head, unsigned length)
+{
+    delay = simd::fmax(delay, simd::float_4::zero());
+    delay = simd::fmin(delay, simd::float_4(1.f));
+
+    // A delay of d samples reads the sample written d-1 steps ago.
+    simd::float_4 back = simd::float_4(simd::int32_4(delay*capacity)) - simd::float_4(1.f);
+    back = simd::fmax(back, simd::float_4::zero());
+    simd::float_4 head = simd::float_4((float)write_head) - back;
+    head += simd::ifelse(head < simd::float_4::zero(), simd::float_4((float)length), simd::float_4::zero());
+    return simd::int32_4(head);
+}
+
+/*
+Four delay lines with two read heads each, stored interleaved: row n of the
+buffer holds sample n of all four lines, so writing is a single vector store.
+The lines share one ring of the longest line's length; shorter lines just
+never read that far back. The ring lives in a DelayArena.
+*/
+struct Delay2H4{
 private:
-    std::vector<float> buffer;
-    unsigned capacity;
+    simd::float_4* buffer;
+    simd::float_4 capacity;
+    unsigned length;
     unsigned write_head = 0;
 
+    simd::float_4 read(simd::float_4 delay)
+    {
+        simd::int32_4 rows = delayRows(delay, capacity, write_head, length);
+        simd::float_4 const* b = buffer;
+        return (b[rows[0]] & laneMask(0))
+             | (b[rows[1]] & laneMask(1))
+             | (b[rows[2]] & laneMask(2))
+             | (b[rows[3]] & laneMask(3));
+    }
+
 public:
-    Delay2H(unsigned cap) 
-    : capacity(cap)
+    // An unbound line, has to be assigned a bound one before stepping.
+    Delay2H4()
+    : buffer(nullptr), capacity(simd::float_4::zero()), length(0) {}
+
+    Delay2H4(simd::float_4 cap, DelayArena& arena) 
+    : capacity(simd::float_4(simd::int32_4(cap)))
     {
-        buffer = std::vector<float>(capacity, 0.f);
+        length = rows(cap);
+        buffer = arena.take(length);
     }
 
-    void step(float in, float delay_1, float delay_2, float* out_1, float* out_2)
+    // Ring rows needed for lines of the given capacities.
+    static unsigned rows(simd::float_4 cap)
+    {
+        simd::int32_4 c = simd::int32_4(cap);
+        return std::max<int>(1, std::max(std::max(c[0], c[1]), std::max(c[2], c[3])));
+    }
+
+    // Arena rows taken by a ring of the given rows.
+    static size_t arenaRows(unsigned rows)
+    {
+        return rows;
+    }
+
+    // Silences the line.
+    void clear(void)
+    {
+        std::fill(buffer, buffer + length, simd::float_4::zero());
+    }
+
+    void step(simd::float_4 in, simd::float_4 delay_1, simd::float_4 delay_2, simd::float_4* out_1, simd::float_4* out_2)
     {
-        if(delay_1 < 0.f) delay_1 = 0.f;
-        if(delay_1 > 1.f) delay_1 = 1.f;
-        if(delay_2 < 0.f) delay_2 = 0.f;
-        if(delay_2 > 1.f) delay_2 = 1.f;
-        
-        if(!capacity){
-            *out_1 = in;
-            *out_2 = in;
-            return;
-        }
-        
         buffer[write_head] = in;
+        *out_1 = read(delay_1);
+        *out_2 = read(delay_2);
         write_head++;
-        if(write_head >= capacity) write_head = 0;
+        if(write_head >= length) write_head = 0;
+    }
 
-        unsigned delay_1_samples = (unsigned)(delay_1*capacity);
-        if(delay_1_samples){
-            int out_head = write_head - delay_1_samples;
-            if(out_head < 0) out_head += capacity;
-            *out_1 = buffer[out_head];
-        }
-        else{
-            *out_1 = in;
-        }
-        unsigned delay_2_samples = (unsigned)(delay_2*capacity);
-        if(delay_2_samples){
-            int out_head = write_head - delay_2_samples;
-            if(out_head < 0) out_head += capacity;
-            *out_2 = buffer[out_head];
-        }
-        else{
-            *out_2 = in;
-        }
+    // One read head, for when the second one would not be heard.
+    void step(simd::float_4 in, simd::float_4 delay, simd::float_4* out)
+    {
+        buffer[write_head] = in;
+        *out = read(delay);
+        write_head++;
+        if(write_head >= length) write_head = 0;
+    }
+};
+
+/*
+Delay2H4 with the samples stored as 16 bit integers, FULL_SCALE volts at
+full range, which halves the memory of the lines. Two ring rows fit one
+arena row. Writing rounds to the nearest step and stores anything within
+DEADBAND steps of zero as silence, so a decaying tail cannot get stuck in a
+limit cycle of rounding errors and still reaches zero.
+*/
+struct Delay2H4i16{
+private:
+    static constexpr float FULL_SCALE = 32.f;
+    static constexpr float DEADBAND = 2.f;
+
+    int16_t* buffer;
+    simd::float_4 capacity;
+    unsigned length;
+    unsigned write_head = 0;
+
+    simd::float_4 read(simd::float_4 delay)
+    {
+        simd::int32_4 rows = delayRows(delay, capacity, write_head, length);
+        int16_t const* b = buffer;
+        simd::float_4 v = simd::float_4(b[4*rows[0]], b[4*rows[1] + 1], b[4*rows[2] + 2], b[4*rows[3] + 3]);
+        return v*simd::float_4(FULL_SCALE/32767.f);
+    }
+
+    void write(simd::float_4 in)
+    {
+        in = simd::clamp(in*simd::float_4(32767.f/FULL_SCALE), simd::float_4(-32767.f), simd::float_4(32767.f));
+        in = simd::ifelse(simd::fabs(in) < simd::float_4(DEADBAND), simd::float_4::zero(), in);
+        __m128i q = _mm_cvtps_epi32(in.v);
+        _mm_storel_epi64((__m128i*)(buffer + 4*write_head), _mm_packs_epi32(q, q));
+    }
+
+public:
+    // An unbound line, has to be assigned a bound one before stepping.
+    Delay2H4i16()
+    : buffer(nullptr), capacity(simd::float_4::zero()), length(0) {}
+
+    Delay2H4i16(simd::float_4 cap, DelayArena& arena)
+    : capacity(simd::float_4(simd::int32_4(cap)))
+    {
+        length = rows(cap);
+        buffer = (int16_t*)arena.take(arenaRows(length));
+    }
+
+    static unsigned rows(simd::float_4 cap)
+    {
+        return Delay2H4::rows(cap);
+    }
+
+    static size_t arenaRows(unsigned rows)
+    {
+        return (rows + 1)/2;
+    }
+
+    void clear(void)
+    {
+        std::fill(buffer, buffer + 4*length, (int16_t)0);
+    }
+
+    void step(simd::float_4 in, simd::float_4 delay_1, simd::float_4 delay_2, simd::float_4* out_1, simd::float_4* out_2)
+    {
+        write(in);
+        *out_1 = read(delay_1);
+        *out_2 = read(delay_2);
+        write_head++;
+        if(write_head >= length) write_head = 0;
+    }
+
+    void step(simd::float_4 in, simd::float_4 delay, simd::float_4* out)
+    {
+        write(in);
+        *out = read(delay);
+        write_head++;
+        if(write_head >= length) write_head = 0;
     }
 };
 
@@ -8,33 +8,56 @@
 
 namespace cs{
 
-struct DelayStage4{
+/*
+N delay lines in groups of four, read with two crossfaded grains so that the
+delay time can change without clicks. All lines share one grain clock.
+LINE stores a group, Delay2H4 or the 16 bit Delay2H4i16.
+
+The older grain is only read while it is still faded in and its scale
+differs from the newer one's. Otherwise both would read the same samples,
+or it would be faded out, so a stable size costs one read per line.
+*/
+template <unsigned N, typename LINE = Delay2H4>
+struct DelayStage{
+    static_assert(N > 0 && N % 4 == 0, "DelayStage works on whole float_4 groups");
+    static constexpr unsigned GROUPS = N/4;
+
 private:
     float grain_sharpness = 4.0;    // [1.0; inf)
     float grain_period = 0.01;      // sec
     
     GrainClock clock;
-    Delay2H lines[4];
+    LINE lines[GROUPS];
     simd::float_4 delay_scale = simd::float_4::zero();
     simd::float_4 scale_current = simd::float_4::zero();
     simd::float_4 scale_previous = simd::float_4::zero();
+    bool gliding = false;
 
 public:
-    DelayStage4(simd::float_4 lengths, float FS)
-    : clock(GrainClock(grain_period*FS)), 
-      lines{
-        Delay2H(lengths[0]*FS), 
-        Delay2H(lengths[1]*FS), 
-        Delay2H(lengths[2]*FS), 
-        Delay2H(lengths[3]*FS)} {}
+    // lengths holds GROUPS vectors, in seconds.
+    DelayStage(simd::float_4 const* lengths, float FS, DelayArena& arena)
+    : clock(GrainClock(grain_period*FS))
+    {
+        for(unsigned g = 0; g < GROUPS; g++){
+            lines[g] = LINE(lengths[g]*FS, arena);
+        }
+    }
+
+    static size_t arenaRows(simd::float_4 const* lengths, float FS)
+    {
+        size_t rows = 0;
+        for(unsigned g = 0; g < GROUPS; g++){
+            rows += DelayArena::roundUp(LINE::arenaRows(LINE::rows(lengths[g]*FS)));
+        }
+        return rows;
+    }
 
-    DelayStage4& operator=(DelayStage4 const& other)
+    DelayStage& operator=(DelayStage const& other)
     {
         clock = other.clock;
-        lines[0] = other.lines[0];
-        lines[1] = other.lines[1];
-        lines[2] = other.lines[2];
-        lines[3] = other.lines[3];
+        for(unsigned g = 0; g < GROUPS; g++){
+            lines[g] = other.lines[g];
+        }
         return *this;
     }
       
@@ -43,47 +66,163 @@ public:
         delay_scale = simd::float_4(scale);
     }
     
+    // The same per-lane scale is used by every group.
     void setScale(simd::float_4 scale)
     {
         delay_scale = scale;
     }
 
-    simd::float_4 process(simd::float_4 in)
+    void clear(void)
+    {
+        for(unsigned g = 0; g < GROUPS; g++){
+            lines[g].clear();
+        }
+    }
+
+    void process(simd::float_4* v)
     {
         if(clock.process()){
             scale_previous = scale_current;
             scale_current = delay_scale;
+            gliding = simd::movemask(scale_current != scale_previous) != 0;
+        }
+        float index = grain_sharpness*clock.getIndex();
+
+        if(!gliding || index >= 1.f){
+            for(unsigned g = 0; g < GROUPS; g++){
+                lines[g].step(v[g], scale_current, &v[g]);
+            }
+            return;
+        }
+        for(unsigned g = 0; g < GROUPS; g++){
+            simd::float_4 A;
+            simd::float_4 B;
+            lines[g].step(v[g], scale_current, scale_previous, &A, &B);
+            v[g] = xfade(A, B, index);
         }
-        float index = clock.getIndex();
-
-        float A;
-        float B;
-        simd::float_4 ret;
-        for(unsigned i = 0; i < 4; i++){
-            lines[i].step(in[i], scale_current[i], scale_previous[i], &A, &B);
-            ret[i] = xfade(A, B, grain_sharpness*index);
+    }
+};
+
+typedef DelayStage<4> DelayStage4;
+
+/*
+A stereo delay with the same grains as DelayStage, also reading the older
+grain only while it is heard. Every input sample is stored once, as a
+(left, right) pair with two pairs per arena row, and the grains are read
+out as (L, R, L, R) for the four lanes that follow.
+*/
+struct StereoDelayStage{
+private:
+    float grain_sharpness = 4.0;    // [1.0; inf)
+    float grain_period = 0.01;      // sec
+
+    GrainClock clock;
+    float* buffer;
+    float capacity;
+    unsigned length;
+    unsigned write_head = 0;
+    float delay_scale = 0.f;
+    float scale_current = 0.f;
+    float scale_previous = 0.f;
+
+    static unsigned pairs(float cap)
+    {
+        return std::max(1, (int)cap);
+    }
+
+    simd::float_4 read(float delay)
+    {
+        delay = clamp(delay, 0.f, 1.f);
+        // A delay of d samples reads the pair written d-1 steps ago.
+        int back = std::max((int)(delay*capacity) - 1, 0);
+        int head = (int)write_head - back;
+        if(head < 0) head += length;
+        float const* pair = buffer + 2*head;
+        return simd::float_4(pair[0], pair[1], pair[0], pair[1]);
+    }
+
+public:
+    // length in seconds.
+    StereoDelayStage(float length, float FS, DelayArena& arena)
+    : clock(GrainClock(grain_period*FS)),
+      capacity((float)(int)(length*FS))
+    {
+        this->length = pairs(length*FS);
+        buffer = (float*)arena.take(rows(this->length));
+    }
+
+    static size_t rows(unsigned pairs)
+    {
+        return (pairs + 1)/2;
+    }
+
+    static size_t arenaRows(float length, float FS)
+    {
+        return DelayArena::roundUp(rows(pairs(length*FS)));
+    }
+
+    StereoDelayStage& operator=(StereoDelayStage const& other)
+    {
+        clock = other.clock;
+        buffer = other.buffer;
+        capacity = other.capacity;
+        length = other.length;
+        write_head = other.write_head;
+        return *this;
+    }
+
+    // Delay time relative to the line length.
+    void setScale(float scale)
+    {
+        delay_scale = scale;
+    }
+
+    void clear(void)
+    {
+        std::fill(buffer, buffer + 2*length, 0.f);
+    }
+
+    simd::float_4 process(float left, float right)
+    {
+        if(clock.process()){
+            scale_previous = scale_current;
+            scale_current = delay_scale;
         }
+        float index = grain_sharpness*clock.getIndex();
 
-        return ret;
+        buffer[2*write_head] = left;
+        buffer[2*write_head + 1] = right;
+        simd::float_4 A = read(scale_current);
+        if(scale_previous != scale_current && index < 1.f){
+            A = xfade(A, read(scale_previous), index);
+        }
+        write_head++;
+        if(write_head >= length) write_head = 0;
+        return A;
     }
 };
 
+template <unsigned N, typename LINE = Delay2H4>
 struct DiffusionStage{
 private:
     float FS;
-    DelayStage4 delay_stage;
-    MatrixMixer4 mixer;
+    DelayStage<N, LINE> delay_stage;
+    MixerType mixer_type;
+    HouseholderMixer<N> mixer;
 
 public:
-    DiffusionStage(simd::float_4 lengths, simd::float_4 mixer_normal, float FS)
+    // The mixer normal is only used by the Householder mixer.
+    DiffusionStage(simd::float_4 const* lengths, simd::float_4 const* mixer_normal, float FS, DelayArena& arena, MixerType mixer_type = MIXER_HOUSEHOLDER)
     : FS(FS),
-      delay_stage(DelayStage4(lengths, FS)),
-      mixer(MatrixMixer4(mixer_normal)) {}
+      delay_stage(DelayStage<N, LINE>(lengths, FS, arena)),
+      mixer_type(mixer_type),
+      mixer(HouseholderMixer<N>(mixer_normal)) {}
 
     DiffusionStage& operator=(DiffusionStage const& other)
     {
         FS = other.FS;
         delay_stage = other.delay_stage;
+        mixer_type = other.mixer_type;
         mixer = other.mixer;
         return *this;
     }
@@ -98,9 +237,20 @@ public:
         delay_stage.setScale(scale);
     }
 
-    simd::float_4 process(simd::float_4 in)
+    void clear(void)
+    {
+        delay_stage.clear();
+    }
+
+    void process(simd::float_4* v)
     {
-        return mixer.process(delay_stage.process(in));
+        delay_stage.process(v);
+        if(mixer_type == MIXER_HADAMARD){
+            HadamardMixer<N>::process(v);
+        }
+        else{
+            mixer.process(v);
+        }
     }
 };
 
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "rack.hpp"
+
+#include "matched_biquad.hpp"
+
+#include <vector>
+
+namespace cs{
+
+/*
+Up to MAX_BANDS band pass filters fed by the same signal, one band per SIMD
+lane. A band is a matched high pass at its lower edge followed by a matched
+low pass at its upper edge, both with the band's Q.
+
+Coefficients are computed for four bands at once, and only for the vectors
+whose edges or Q differ from the last call, so bands that hold still cost
+nothing while others are modulated. Called once per block, the filters ramp
+their coefficients to the new ones over the block.
+*/
+struct FilterBank{
+    static constexpr unsigned MAX_BANDS = 16;
+    static constexpr unsigned MAX_VECTORS = MAX_BANDS/4;
+
+private:
+    std::vector<HighPass<simd::float_4>> high;
+    std::vector<LowPass<simd::float_4>> low;
+    // Edges and Q the coefficients were computed for, negative until then.
+    simd::float_4 lower[MAX_VECTORS];
+    simd::float_4 upper[MAX_VECTORS];
+    simd::float_4 q[MAX_VECTORS];
+
+public:
+    FilterBank(float FS = 48000.f)
+    : high(MAX_VECTORS, HighPass<simd::float_4>(FS)),
+      low(MAX_VECTORS, LowPass<simd::float_4>(FS))
+    {
+        for(unsigned v = 0; v < MAX_VECTORS; v++){
+            lower[v] = simd::float_4(-1.f);
+            upper[v] = simd::float_4(-1.f);
+            q[v] = simd::float_4(-1.f);
+        }
+    }
+
+    // Edges in Hz and Q of bands 0 to 4*vectors-1, one lane per band,
+    // reached after `steps` samples. Returns the number of vectors whose
+    // coefficients were recomputed.
+    unsigned setBands(simd::float_4 const* lower_edges, simd::float_4 const* upper_edges, simd::float_4 const* Q, unsigned vectors, unsigned steps = 1)
+    {
+        unsigned updated = 0;
+        for(unsigned v = 0; v < vectors; v++){
+            simd::float_4 changed = (lower_edges[v] != lower[v]) | (upper_edges[v] != upper[v]) | (Q[v] != q[v]);
+            if(!simd::movemask(changed)){
+                continue;
+            }
+            // Nothing to ramp from the first time.
+            unsigned ramp = simd::movemask(q[v] < simd::float_4(0.f)) ? 1 : steps;
+            high[v].rampParams(lower_edges[v], Q[v], ramp);
+            low[v].rampParams(upper_edges[v], Q[v], ramp);
+            lower[v] = lower_edges[v];
+            upper[v] = upper_edges[v];
+            q[v] = Q[v];
+            updated++;
+        }
+        return updated;
+    }
+
+    // One output per band, in `vectors` vectors.
+    void process(float in, simd::float_4* out, unsigned vectors)
+    {
+        for(unsigned v = 0; v < vectors; v++){
+            out[v] = low[v].process(high[v].process(simd::float_4(in)));
+        }
+    }
+};
+
+}
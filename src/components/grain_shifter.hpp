@@ -0,0 +1,203 @@
+#pragma once
+
+#include "rack.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace cs{
+
+/*
+Pitch shifter of GRAINS overlapping grains read from one delay line. The
+grains are the lanes of GRAINS/4 vectors: phases, windows and interpolation
+are computed for four grains at once, only the reads are per grain.
+
+All grains run through the window at the same speed and evenly spread, so
+their Hann windows always sum to GRAINS/2. While a grain runs, its delay
+sweeps |ratio - 1| window lengths, which plays it back at `ratio` times the
+input speed, and it jumps back when the grain wraps, where its window is
+zero. Every grain has its own ratio, picked up when it wraps, so ratio
+changes need no ramp.
+
+Grains that overlap read at different delays. Evenly spaced, they cancel
+each other at many frequencies, so every grain starts at a random offset of
+up to `jitter` window lengths, and the output is normalized by power rather
+than amplitude as the jitter grows. Without jitter a ratio of one is a clean
+one sample delay.
+*/
+template <unsigned GRAINS = 4>
+struct GrainShifter{
+    static_assert(GRAINS > 0 && GRAINS % 4 == 0, "GrainShifter works on whole float_4 groups of grains");
+    static constexpr unsigned VECTORS = GRAINS/4;
+    // Highest ratio the delay line is sized for, two octaves up.
+    static constexpr float MAX_RATIO = 4.f;
+
+private:
+    std::vector<float> buffer;
+    int32_t mask;
+    unsigned write_head = 0;
+    float max_window;
+    float window;
+    float step;
+    float jitter = 0.f;
+    float gain = 2.f/GRAINS;
+    std::minstd_rand random;
+    simd::float_4 phase[VECTORS];
+    simd::float_4 ratio[VECTORS];
+    // Delay swept by each grain, and whether it shrinks (ratio above one),
+    // for the current run of the grain and for its next one.
+    simd::float_4 span[VECTORS];
+    simd::float_4 rising[VECTORS];
+    simd::float_4 next_span[VECTORS];
+    simd::float_4 next_rising[VECTORS];
+    simd::float_4 offset[VECTORS];
+
+    void updateSpans(void)
+    {
+        for(unsigned v = 0; v < VECTORS; v++){
+            next_span[v] = simd::fabs(ratio[v] - simd::float_4(1.f))*simd::float_4(window);
+            next_rising[v] = ratio[v] > simd::float_4(1.f);
+        }
+    }
+
+    float nextOffset(void)
+    {
+        return jitter*window*(float)(random() - random.min())/(float)(random.max() - random.min());
+    }
+
+public:
+    // max_window in seconds, the longest window setWindow() accepts. The
+    // seed sets the jitter's random sequence.
+    GrainShifter(float FS = 48000.f, float max_window = 0.1f, unsigned seed = 1)
+    : random(seed)
+    {
+        this->max_window = std::max(4.f, max_window*FS);
+        unsigned length = 1;
+        while(length < MAX_RATIO*this->max_window + 3.f){
+            length *= 2;
+        }
+        buffer.assign(length, 0.f);
+        mask = length - 1;
+        for(unsigned v = 0; v < VECTORS; v++){
+            phase[v] = (simd::float_4(0.f, 1.f, 2.f, 3.f) + simd::float_4(4.f*v))*simd::float_4(1.f/GRAINS);
+            ratio[v] = simd::float_4(1.f);
+            offset[v] = simd::float_4::zero();
+        }
+        setWindow(this->max_window);
+        reset();
+    }
+
+    // Window length in samples, clamped to the maximum.
+    void setWindow(float samples)
+    {
+        window = clamp(samples, 4.f, max_window);
+        step = 1.f/window;
+        updateSpans();
+    }
+
+    void setRatio(float r)
+    {
+        simd::float_4 ratios[VECTORS];
+        std::fill(ratios, ratios + VECTORS, simd::float_4(r));
+        setRatios(ratios);
+    }
+
+    // GRAINS/4 vectors of playback ratios, one per grain.
+    void setRatios(simd::float_4 const* ratios)
+    {
+        for(unsigned v = 0; v < VECTORS; v++){
+            ratio[v] = simd::clamp(ratios[v], simd::float_4(0.f), simd::float_4(MAX_RATIO));
+        }
+        updateSpans();
+    }
+
+    // Largest random start offset, in window lengths (0 to 1).
+    void setJitter(float amount)
+    {
+        jitter = clamp(amount, 0.f, 1.f);
+        // The squared windows of evenly spread grains sum to 3*GRAINS/8.
+        // Offsets of a quarter window decorrelate grains at audio rates.
+        float power_gain = std::sqrt(8.f/(3.f*GRAINS));
+        gain = crossfade(2.f/GRAINS, power_gain, std::min(1.f, 4.f*jitter));
+    }
+
+    // Silences the delay line, the grains take their ratios right away.
+    void reset(void)
+    {
+        std::fill(buffer.begin(), buffer.end(), 0.f);
+        std::copy(next_span, next_span + VECTORS, span);
+        std::copy(next_rising, next_rising + VECTORS, rising);
+    }
+
+    // Only silences the delay line, for a shifter that is not processed
+    // while another thread sets its ratios.
+    void clear(void)
+    {
+        std::fill(buffer.begin(), buffer.end(), 0.f);
+    }
+
+    // Gain on signals the grains all read alike, low frequencies or a ratio
+    // of one. It is the largest gain, above one with jitter.
+    float getCoherentGain(void)
+    {
+        return 0.5f*GRAINS*gain;
+    }
+
+    // Samples an input can stay in the delay line.
+    size_t getLength(void)
+    {
+        return buffer.size();
+    }
+
+    // Only feeds the delay line, so that it is current once the output is
+    // needed again. The grains stand still meanwhile.
+    void write(float in)
+    {
+        buffer[write_head] = in;
+        write_head = (write_head + 1) & mask;
+    }
+
+    float process(float in)
+    {
+        buffer[write_head] = in;
+        simd::float_4 sum = simd::float_4::zero();
+        for(unsigned v = 0; v < VECTORS; v++){
+            simd::float_4 sweep = simd::ifelse(rising[v], simd::float_4(1.f) - phase[v], phase[v]);
+            simd::float_4 delay = simd::float_4(1.f) + offset[v] + span[v]*sweep;
+            simd::int32_4 whole = simd::int32_4(delay);
+            simd::float_4 fraction = delay - simd::float_4(whole);
+
+            // Between the samples `whole` and `whole + 1` steps old.
+            simd::int32_4 newer = simd::int32_4((int32_t)write_head) - whole;
+            simd::float_4 a;
+            simd::float_4 b;
+            for(unsigned i = 0; i < 4; i++){
+                a[i] = buffer[newer[i] & mask];
+                b[i] = buffer[(newer[i] - 1) & mask];
+            }
+            simd::float_4 x = a + (b - a)*fraction;
+
+            simd::float_4 w = simd::sin(simd::float_4(M_PI)*phase[v]);
+            sum += x*w*w;
+
+            phase[v] += simd::float_4(step);
+            simd::float_4 wrapped = phase[v] >= simd::float_4(1.f);
+            int wraps = simd::movemask(wrapped);
+            if(wraps){
+                phase[v] = simd::ifelse(wrapped, phase[v] - simd::float_4(1.f), phase[v]);
+                span[v] = simd::ifelse(wrapped, next_span[v], span[v]);
+                rising[v] = simd::ifelse(wrapped, next_rising[v], rising[v]);
+                for(unsigned i = 0; i < 4; i++){
+                    if(wraps & (1 << i)){
+                        offset[v][i] = nextOffset();
+                    }
+                }
+            }
+        }
+        write_head = (write_head + 1) & mask;
+        return (sum[0] + sum[1] + sum[2] + sum[3])*gain;
+    }
+};
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "rack.hpp"
+
+namespace cs{
+
+/*
+Moves linearly to a target in a fixed number of steps. For values that are
+evaluated at control rate but applied every sample.
+*/
+template <typename T>
+struct LinearRamp{
+private:
+    T value = T(0.f);
+    T target = T(0.f);
+    T step = T(0.f);
+    unsigned steps_left = 0;
+
+public:
+    void setTarget(T new_target, unsigned steps)
+    {
+        target = new_target;
+        if(steps <= 1){
+            value = target;
+            steps_left = 0;
+            return;
+        }
+        step = (target - value) / T((float)steps);
+        steps_left = steps;
+    }
+
+    T process(void)
+    {
+        if(steps_left){
+            steps_left--;
+            value = steps_left ? value + step : target;
+        }
+        return value;
+    }
+
+    T getValue(void)
+    {
+        return value;
+    }
+};
+
+/*
+Ramps N coefficients of a filter linearly to the ones computed for the next
+block, so the transcendental math runs once per block. The filter keeps its
+coefficients and passes pointers to them, always in the same order.
+*/
+template <typename T, unsigned N>
+struct CoefficientRamp{
+private:
+    T step[N] = {};
+    T target[N] = {};
+    unsigned steps_left = 0;
+
+public:
+    // The coefficients hold the targets, they are set back to `from` and
+    // reach the targets after `steps` calls of process().
+    void start(T* const* coefficients, T const* from, unsigned steps)
+    {
+        if(steps <= 1){
+            steps_left = 0;
+            return;
+        }
+        T k = T(1.f/steps);
+        for(unsigned i = 0; i < N; i++){
+            target[i] = *coefficients[i];
+            step[i] = (target[i] - from[i])*k;
+            *coefficients[i] = from[i];
+        }
+        steps_left = steps;
+    }
+
+    void stop(void)
+    {
+        steps_left = 0;
+    }
+
+    void process(T* const* coefficients)
+    {
+        if(!steps_left){
+            return;
+        }
+        steps_left--;
+        for(unsigned i = 0; i < N; i++){
+            *coefficients[i] = steps_left ? *coefficients[i] + step[i] : target[i];
+        }
+    }
+};
+
+}
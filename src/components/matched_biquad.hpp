@@ -11,6 +11,8 @@ http://www.solostuff.net/wp-content/uploads/2019/05/Fast-Modulation-of-Filter-Pa
 
 #include "rack.hpp"
 
+#include "linear_ramp.hpp"
+
 namespace cs{
 
 template <typename T>
@@ -28,6 +30,8 @@ struct LowPass {
     T re2[2] = {};
     T im2[2] = {};
 
+    CoefficientRamp<T, 5> ramp;
+
     LowPass(float FS) : Ts(T(1/FS)), Flimit(T(FS*0.45)) {}
 
     void setParams(T freq, T Q = T(0.5))
@@ -49,17 +53,33 @@ struct LowPass {
         a[1] = T(-2)*alpha;
         a[2] = alpha*alpha + beta*beta;
 
-        T f02 = dfreq*dfreq;
+        // Matched at Nyquist, with the frequency relative to it.
+        T f02 = T(4)*dfreq*dfreq;
         T r0 = a[0] + a[1] + a[2];
         T r1 = f02*(a[0] - a[1] + a[2])/simd::sqrt((1-f02)*(1-f02) + f02/(Q*Q));
 
         b[0] = T(0.5)*(r0 + r1);
         b[1] = r0 - b[0];
         b[2] = T(0);
+        ramp.stop();
+    }
+
+    // Moves alpha, beta and b[] linearly to those of the new parameters over
+    // the next `steps` samples. The pole pair moves on a straight line
+    // between two stable ones, so it stays stable on the way.
+    void rampParams(T freq, T Q, unsigned steps)
+    {
+        T from[5] = {alpha, beta, b[0], b[1], b[2]};
+        setParams(freq, Q);
+        T* coefficients[5] = {&alpha, &beta, &b[0], &b[1], &b[2]};
+        ramp.start(coefficients, from, steps);
     }
 
     T process(T signal)
     {
+        T* coefficients[5] = {&alpha, &beta, &b[0], &b[1], &b[2]};
+        ramp.process(coefficients);
+
         x[2] = x[1];
         x[1] = x[0];
         re1[1] = re1[0];
@@ -93,6 +113,8 @@ struct HighPass {
     T re2[2] = {};
     T im2[2] = {};
 
+    CoefficientRamp<T, 5> ramp;
+
     HighPass(float FS) : Ts(T(1/FS)), Flimit(T(FS*0.45)) {}
 
     void setParams(T freq, T Q = T(0.5))
@@ -114,16 +136,32 @@ struct HighPass {
         a[1] = T(-2)*alpha;
         a[2] = alpha*alpha + beta*beta;
 
-        T f02 = dfreq*dfreq;
+        // Matched at Nyquist, with the frequency relative to it.
+        T f02 = T(4)*dfreq*dfreq;
         T r1 = (a[0] - a[1] + a[2])/simd::sqrt((1-f02)*(1-f02) + f02/(Q*Q));
 
         b[0] = T(0.25)*r1;
         b[1] = T(-2)*b[0];
         b[2] = b[0];
+        ramp.stop();
+    }
+
+    // Moves alpha, beta and b[] linearly to those of the new parameters over
+    // the next `steps` samples. The pole pair moves on a straight line
+    // between two stable ones, so it stays stable on the way.
+    void rampParams(T freq, T Q, unsigned steps)
+    {
+        T from[5] = {alpha, beta, b[0], b[1], b[2]};
+        setParams(freq, Q);
+        T* coefficients[5] = {&alpha, &beta, &b[0], &b[1], &b[2]};
+        ramp.start(coefficients, from, steps);
     }
 
     T process(T signal)
     {        
+        T* coefficients[5] = {&alpha, &beta, &b[0], &b[1], &b[2]};
+        ramp.process(coefficients);
+
         x[2] = x[1];
         x[1] = x[0];
         re1[1] = re1[0];
@@ -2,6 +2,8 @@
 
 #include "rack.hpp"
 
+#include "linear_ramp.hpp"
+
 namespace cs{
 
 template <typename T>
@@ -15,6 +17,7 @@ struct HighShelf {
     T a = T(0.f);
     T b0 = T(1.f);
     T b1 = T(0.f);
+    CoefficientRamp<T, 3> ramp;
 
     HighShelf(float FS) : period_limit(T(2/FS)) {}
     
@@ -32,10 +35,23 @@ struct HighShelf {
 
         b0 = (T(1.f) + a) / (T(1.f) + b);
         b1 = b0 * b;
+        ramp.stop();
+    }
+
+    // Moves the coefficients linearly to those of the new parameters over the
+    // next `steps` samples. A first order section stays stable on the way.
+    void rampParams(T freq, T gain, unsigned steps)
+    {
+        T from[3] = {a, b0, b1};
+        setParams(freq, gain);
+        T* coefficients[3] = {&a, &b0, &b1};
+        ramp.start(coefficients, from, steps);
     }
 
     T process(T in)
     {
+        T* coefficients[3] = {&a, &b0, &b1};
+        ramp.process(coefficients);
         z = b0*in + b1*in1 - a*z;
         in1 = in;
         return z;
@@ -52,6 +68,7 @@ struct Tilting{
     T a1 = T(0.f);
     T b0 = T(1.f);
     T b1 = T(0.f);
+    CoefficientRamp<T, 3> ramp;
 
     Tilting(float FS) : period_limit(T(2/FS)) {}
     
@@ -70,10 +87,23 @@ struct Tilting{
         T b0mb1 = simd::sqrt((T(1.f)-a1)*(T(1.f)-a1)*(G + T(1.f)/(G*f_c*f_c))/(T(1.f)/G + G/(f_c*f_c)));
         b0 = (b0pb1 + b0mb1)*T(0.5f);
         b1 = b0pb1 - b0;
+        ramp.stop();
+    }
+
+    // Moves the coefficients linearly to those of the new parameters over the
+    // next `steps` samples. A first order section stays stable on the way.
+    void rampParams(T f, T G, unsigned steps)
+    {
+        T from[3] = {a1, b0, b1};
+        setParams(f, G);
+        T* coefficients[3] = {&a1, &b0, &b1};
+        ramp.start(coefficients, from, steps);
     }
 
     T process(T in)
     {
+        T* coefficients[3] = {&a1, &b0, &b1};
+        ramp.process(coefficients);
         z = b0*in + b1*in1 - a1*z;
         in1 = in;
         return z;
@@ -91,6 +121,8 @@ struct TwoShelves{
     T b0 = T(1.f);
     T b1 = T(0.f);
 
+    CoefficientRamp<T, 3> ramp;
+
     TwoShelves(float FS) : period_limit(T(2/FS)) {}
     
     void setParams(T f, T G0, T G1)
@@ -109,10 +141,32 @@ struct TwoShelves{
         T b0mb1 = simd::sqrt((T(1.f)-a1)*(T(1.f)-a1)*(G0 + G1/(f_c*f_c))/(T(1.f)/G0 + T(1.f)/(G1*f_c*f_c)));
         b0 = (b0pb1 + b0mb1)*T(0.5f);
         b1 = b0pb1 - b0;
+        ramp.stop();
+    }
+
+    // Moves the coefficients linearly to those of the new parameters over the
+    // next `steps` samples. A first order section stays stable on the way.
+    void rampParams(T f, T G0, T G1, unsigned steps)
+    {
+        T from[3] = {a1, b0, b1};
+        setParams(f, G0, G1);
+        T* coefficients[3] = {&a1, &b0, &b1};
+        ramp.start(coefficients, from, steps);
+    }
+
+    // Takes over the coefficients and the ramp of another section, keeps the state.
+    void copyParams(TwoShelves const& other)
+    {
+        a1 = other.a1;
+        b0 = other.b0;
+        b1 = other.b1;
+        ramp = other.ramp;
     }
 
     T process(T in)
     {
+        T* coefficients[3] = {&a1, &b0, &b1};
+        ramp.process(coefficients);
         z = b0*in + b1*in1 - a1*z;
         in1 = in;
         return z;
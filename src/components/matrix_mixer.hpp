@@ -4,43 +4,97 @@
 
 namespace cs{
 
-struct MatrixMixer4{
+// Every lane of the result holds the sum of the four lanes of v.
+inline simd::float_4 broadcastSum(simd::float_4 v)
+{
+    v += simd::float_4(_mm_shuffle_ps(v.v, v.v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v += simd::float_4(_mm_shuffle_ps(v.v, v.v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return v;
+}
+
+enum MixerType {
+    MIXER_HOUSEHOLDER,
+    MIXER_HADAMARD
+};
+
+/*
+Householder reflection I - 2nn'/|n|^2 of N = 4*GROUPS channels, stored as
+GROUPS vectors. It is applied as v - n*(2(n.v)/|n|^2), so the cost grows
+linearly with N and the dot product never leaves the registers.
+*/
+template <unsigned N>
+struct HouseholderMixer{
+    static_assert(N > 0 && N % 4 == 0, "HouseholderMixer works on whole float_4 groups");
+    static constexpr unsigned GROUPS = N/4;
+
 private:
-    simd::float_4 rows[4];
+    simd::float_4 normal[GROUPS];
+    simd::float_4 scaled_normal[GROUPS];
 
-    float sumFloat4(simd::float_4 v)
+public:
+    HouseholderMixer(simd::float_4 const* n)
     {
-        return v[0] + v[1] + v[2] + v[3];
+        simd::float_4 norm = simd::float_4::zero();
+        for(unsigned g = 0; g < GROUPS; g++){
+            normal[g] = n[g];
+            norm += n[g]*n[g];
+        }
+        norm = broadcastSum(norm);
+        // A zero normal leaves the signal unmixed.
+        simd::float_4 scaler = simd::ifelse(norm > simd::float_4::zero(), simd::float_4(2.f)/norm, simd::float_4::zero());
+        for(unsigned g = 0; g < GROUPS; g++){
+            scaled_normal[g] = scaler*normal[g];
+        }
     }
 
-public:
-    MatrixMixer4(simd::float_4 const normal)
+    void process(simd::float_4* v)
     {
-        simd::float_4 n0 = simd::float_4(normal[0]);
-        simd::float_4 n1 = simd::float_4(normal[1]);
-        simd::float_4 n2 = simd::float_4(normal[2]);
-        simd::float_4 n3 = simd::float_4(normal[3]);
-        simd::float_4 n = normal;
-        simd::float_4 I0 = simd::float_4(1, 0, 0, 0);
-        simd::float_4 I1 = simd::float_4(0, 1, 0, 0);
-        simd::float_4 I2 = simd::float_4(0, 0, 1, 0);
-        simd::float_4 I3 = simd::float_4(0, 0, 0, 1);
-        simd::float_4 scaler = simd::float_4(2.0/sumFloat4(n*n));
-        rows[0] = I0 - scaler*n0*n;
-        rows[1] = I1 - scaler*n1*n;
-        rows[2] = I2 - scaler*n2*n;
-        rows[3] = I3 - scaler*n3*n;
+        simd::float_4 dot = simd::float_4::zero();
+        for(unsigned g = 0; g < GROUPS; g++){
+            dot += normal[g]*v[g];
+        }
+        dot = broadcastSum(dot);
+        for(unsigned g = 0; g < GROUPS; g++){
+            v[g] -= scaled_normal[g]*dot;
+        }
     }
+};
+
+/*
+Orthonormal Hadamard matrix of N = 4*GROUPS channels (N a power of two),
+applied as a fast Walsh-Hadamard transform: butterflies within each vector
+through shuffles, then between the vectors, then a single scale.
+*/
+template <unsigned N>
+struct HadamardMixer{
+    static_assert(N > 0 && N % 4 == 0 && (N & (N - 1)) == 0, "HadamardMixer needs a power of two of at least 4 channels");
+    static constexpr unsigned GROUPS = N/4;
 
-    simd::float_4 process(simd::float_4 v)
+    static void process(simd::float_4* v)
     {
-        simd::float_4 ret;
-        ret[0] = sumFloat4(v*rows[0]);
-        ret[1] = sumFloat4(v*rows[1]);
-        ret[2] = sumFloat4(v*rows[2]);
-        ret[3] = sumFloat4(v*rows[3]);
-        return ret;
+        simd::float_4 const sign_1 = simd::float_4(1.f, -1.f, 1.f, -1.f);
+        simd::float_4 const sign_2 = simd::float_4(1.f, 1.f, -1.f, -1.f);
+        for(unsigned g = 0; g < GROUPS; g++){
+            simd::float_4 x = v[g];
+            x = simd::float_4(_mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(2, 3, 0, 1))) + x*sign_1;
+            x = simd::float_4(_mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(1, 0, 3, 2))) + x*sign_2;
+            v[g] = x;
+        }
+        for(unsigned h = 1; h < GROUPS; h *= 2){
+            for(unsigned g = 0; g < GROUPS; g += 2*h){
+                for(unsigned k = g; k < g + h; k++){
+                    simd::float_4 a = v[k];
+                    simd::float_4 b = v[k + h];
+                    v[k] = a + b;
+                    v[k + h] = a - b;
+                }
+            }
+        }
+        simd::float_4 scale = simd::float_4(1.f/std::sqrt((float)N));
+        for(unsigned g = 0; g < GROUPS; g++){
+            v[g] *= scale;
+        }
     }
 };
 
-}
\ No newline at end of file
+}
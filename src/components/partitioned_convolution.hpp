@@ -0,0 +1,175 @@
+#pragma once
+
+#include "rack.hpp"
+#include <pffft.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace cs{
+
+/*
+Convolution with an impulse response of any length. The first BLOCK taps
+are applied directly, the rest as uniform partitions of BLOCK taps in the
+frequency domain (pffft, overlap-save), so the output has no latency.
+
+The spectra of the past input blocks are kept in a frequency domain delay
+line. At the end of a block only the newest one is transformed and
+multiplied, the products with the older ones are accumulated a few
+partitions per sample while the next block fills. The cost per sample
+grows with the impulse length over BLOCK instead of with the length.
+*/
+struct PartitionedConvolver{
+public:
+    static constexpr unsigned BLOCK = 256;
+    static constexpr unsigned FFT_LENGTH = 2*BLOCK;
+
+private:
+    static constexpr unsigned ROWS = FFT_LENGTH/4;
+
+    // Transforms only read the setup, so all convolvers share one.
+    struct Setup{
+        PFFFT_Setup* setup;
+        Setup() : setup(pffft_new_setup(FFT_LENGTH, PFFFT_REAL)) {}
+        ~Setup() { pffft_destroy_setup(setup); }
+    };
+
+    static PFFFT_Setup* fft(void)
+    {
+        static Setup s;
+        return s.setup;
+    }
+
+    size_t length = 0;
+    unsigned partitions = 0;
+    unsigned per_sample = 0;
+
+    // Taps 0 to BLOCK-1, applied in the time domain on a doubled history.
+    simd::float_4 head[BLOCK/4];
+    float history[2*BLOCK];
+    unsigned history_head = 0;
+
+    // Partition spectra of taps BLOCK on, and the delay line of input spectra.
+    std::vector<simd::float_4> kernel;
+    std::vector<simd::float_4> spectra;
+    unsigned newest = 0;
+    unsigned next_partition = 1;
+
+    // Previous and current input block.
+    simd::float_4 frame[ROWS];
+    simd::float_4 accumulator[ROWS];
+    simd::float_4 work[ROWS];
+    simd::float_4 result[ROWS];
+    unsigned phase = 0;
+
+    float* spectrum(std::vector<simd::float_4>& v, unsigned partition)
+    {
+        return (float*)(v.data() + partition*ROWS);
+    }
+
+    void accumulate(unsigned end)
+    {
+        for(; next_partition < end; next_partition++){
+            // Partition p meets the input block p - 1 blocks before the newest one.
+            unsigned block = (newest + partitions - (next_partition - 1)) % partitions;
+            pffft_zconvolve_accumulate(fft(), spectrum(spectra, block), spectrum(kernel, next_partition), (float*)accumulator, 1.f/FFT_LENGTH);
+        }
+    }
+
+    void endBlock(void)
+    {
+        accumulate(partitions);
+        newest = (newest + 1) % partitions;
+        pffft_transform(fft(), (float*)frame, spectrum(spectra, newest), (float*)work, PFFFT_FORWARD);
+        pffft_zconvolve_accumulate(fft(), spectrum(spectra, newest), spectrum(kernel, 0), (float*)accumulator, 1.f/FFT_LENGTH);
+        pffft_transform(fft(), (float*)accumulator, (float*)result, (float*)work, PFFFT_BACKWARD);
+
+        for(unsigned i = 0; i < ROWS/2; i++){
+            frame[i] = frame[i + ROWS/2];
+            accumulator[2*i] = simd::float_4::zero();
+            accumulator[2*i + 1] = simd::float_4::zero();
+        }
+        next_partition = 1;
+    }
+
+public:
+    // Without an impulse the output is silent.
+    PartitionedConvolver()
+    {
+        setImpulse(nullptr, 0);
+    }
+
+    // Allocates, call off the audio thread.
+    void setImpulse(float const* impulse, size_t n)
+    {
+        length = n;
+        float* h = (float*)head;
+        for(unsigned i = 0; i < BLOCK; i++){
+            h[i] = (i < n) ? impulse[i] : 0.f;
+        }
+
+        partitions = (n > BLOCK) ? (n - 1)/BLOCK : 0;
+        per_sample = (partitions + BLOCK - 2)/BLOCK;
+        kernel.assign(partitions*ROWS, simd::float_4::zero());
+        spectra.assign(partitions*ROWS, simd::float_4::zero());
+        for(unsigned p = 0; p < partitions; p++){
+            // Overlap-save: the taps fill the first half of the frame.
+            simd::float_4 taps[ROWS] = {};
+            size_t begin = BLOCK + (size_t)p*BLOCK;
+            size_t end = std::min(n, begin + BLOCK);
+            std::copy(impulse + begin, impulse + end, (float*)taps);
+            pffft_transform(fft(), (float*)taps, spectrum(kernel, p), (float*)work, PFFFT_FORWARD);
+        }
+        reset();
+    }
+
+    // Silences the history.
+    void reset(void)
+    {
+        std::fill(history, history + 2*BLOCK, 0.f);
+        std::fill(spectra.begin(), spectra.end(), simd::float_4::zero());
+        for(unsigned i = 0; i < ROWS; i++){
+            frame[i] = simd::float_4::zero();
+            accumulator[i] = simd::float_4::zero();
+            result[i] = simd::float_4::zero();
+        }
+        history_head = 0;
+        newest = 0;
+        next_partition = 1;
+        phase = 0;
+    }
+
+    // Length of the impulse, in samples.
+    size_t getLength(void)
+    {
+        return length;
+    }
+
+    float process(float in)
+    {
+        history_head = (history_head == 0) ? BLOCK - 1 : history_head - 1;
+        history[history_head] = in;
+        history[history_head + BLOCK] = in;
+        simd::float_4 acc = simd::float_4::zero();
+        for(unsigned g = 0; g < BLOCK/4; g++){
+            acc += head[g]*simd::float_4::load(history + history_head + 4*g);
+        }
+        float out = acc[0] + acc[1] + acc[2] + acc[3];
+        if(partitions == 0){
+            return out;
+        }
+
+        // The tail of the last block's convolution lines up with this block.
+        out += ((float*)result)[BLOCK + phase];
+        ((float*)frame)[BLOCK + phase] = in;
+        accumulate(std::min(next_partition + per_sample, partitions));
+        phase++;
+        if(phase == BLOCK){
+            phase = 0;
+            endBlock();
+        }
+        return out;
+    }
+};
+
+}
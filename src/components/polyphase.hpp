@@ -0,0 +1,148 @@
+#pragma once
+
+#include "rack.hpp"
+
+namespace cs{
+
+/*
+Windowed-sinc lowpass shared by the decimator and the interpolator: cutoff
+at 0.45 of the low rate, Blackman window, TAPS_PER_PHASE taps for every
+phase of the ratio. Coefficients are broadcast to all lanes, so a tap is a
+single vector multiply-add on four channels.
+*/
+struct PolyphaseFilter{
+public:
+    static constexpr unsigned MAX_RATIO = 4;
+    static constexpr unsigned TAPS_PER_PHASE = 16;
+    static constexpr unsigned MAX_TAPS = MAX_RATIO*TAPS_PER_PHASE;
+
+protected:
+    unsigned ratio = 1;
+    unsigned taps = TAPS_PER_PHASE;
+    simd::float_4 coefs[MAX_TAPS];
+
+    void design(unsigned r)
+    {
+        ratio = (r < 1) ? 1 : (r > MAX_RATIO ? (unsigned)MAX_RATIO : r);
+        taps = ratio*TAPS_PER_PHASE;
+        float cutoff = 0.45f/ratio;
+        float center = 0.5f*(taps - 1);
+        float sum = 0.f;
+        float h[MAX_TAPS];
+        for(unsigned i = 0; i < taps; i++){
+            float t = i - center;
+            float sinc = (t == 0.f) ? 2.f*cutoff : std::sin(2.f*M_PI*cutoff*t)/(M_PI*t);
+            float phase = 2.f*M_PI*i/(taps - 1);
+            float window = 0.42f - 0.5f*std::cos(phase) + 0.08f*std::cos(2.f*phase);
+            h[i] = sinc*window;
+            sum += h[i];
+        }
+        for(unsigned i = 0; i < taps; i++){
+            coefs[i] = simd::float_4(h[i]/sum);
+        }
+    }
+
+public:
+    unsigned getRatio(void)
+    {
+        return ratio;
+    }
+
+    // Delay of the filter, in samples of the high rate.
+    float getLatency(void)
+    {
+        return 0.5f*(taps - 1);
+    }
+};
+
+// Takes `ratio` high rate samples per low rate sample.
+struct PolyphaseDecimator4 : PolyphaseFilter{
+private:
+    // Doubled, so that the taps always read a contiguous window.
+    simd::float_4 history[2*MAX_TAPS];
+    unsigned head = 0;
+
+public:
+    PolyphaseDecimator4(unsigned ratio = 1)
+    {
+        setRatio(ratio);
+    }
+
+    // Clears the history, call off the audio thread.
+    void setRatio(unsigned r)
+    {
+        design(r);
+        head = 0;
+        for(unsigned i = 0; i < 2*MAX_TAPS; i++){
+            history[i] = simd::float_4::zero();
+        }
+    }
+
+    void push(simd::float_4 in)
+    {
+        head = (head == 0) ? taps - 1 : head - 1;
+        history[head] = in;
+        history[head + taps] = in;
+    }
+
+    // Low rate sample after the last push.
+    simd::float_4 process(void)
+    {
+        simd::float_4 const* x = history + head;
+        simd::float_4 acc = simd::float_4::zero();
+        for(unsigned i = 0; i < taps; i++){
+            acc += coefs[i]*x[i];
+        }
+        return acc;
+    }
+};
+
+// Produces `ratio` high rate samples per low rate sample.
+struct PolyphaseInterpolator4 : PolyphaseFilter{
+private:
+    // Coefficients sorted by phase and scaled by the ratio.
+    simd::float_4 phase_coefs[MAX_TAPS];
+    simd::float_4 history[2*TAPS_PER_PHASE];
+    unsigned head = 0;
+
+public:
+    PolyphaseInterpolator4(unsigned ratio = 1)
+    {
+        setRatio(ratio);
+    }
+
+    // Clears the history, call off the audio thread.
+    void setRatio(unsigned r)
+    {
+        design(r);
+        for(unsigned p = 0; p < ratio; p++){
+            for(unsigned j = 0; j < TAPS_PER_PHASE; j++){
+                phase_coefs[p*TAPS_PER_PHASE + j] = coefs[j*ratio + p]*simd::float_4((float)ratio);
+            }
+        }
+        head = 0;
+        for(unsigned i = 0; i < 2*TAPS_PER_PHASE; i++){
+            history[i] = simd::float_4::zero();
+        }
+    }
+
+    // Writes `ratio` samples to out.
+    void process(simd::float_4 in, simd::float_4* out)
+    {
+        head = (head == 0) ? TAPS_PER_PHASE - 1 : head - 1;
+        history[head] = in;
+        history[head + TAPS_PER_PHASE] = in;
+
+        simd::float_4 const* x = history + head;
+        for(unsigned p = 0; p < ratio; p++){
+            simd::float_4 const* h = phase_coefs + p*TAPS_PER_PHASE;
+            simd::float_4 acc = simd::float_4::zero();
+            for(unsigned j = 0; j < TAPS_PER_PHASE; j++){
+                acc += h[j]*x[j];
+            }
+            out[p] = acc;
+        }
+    }
+};
+
+}
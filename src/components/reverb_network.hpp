@@ -0,0 +1,366 @@
+#pragma once
+
+#include "rack.hpp"
+
+#include "diffusion_stage.hpp"
+#include "grain_shifter.hpp"
+#include "one_pole.hpp"
+#include "matched_shelving.hpp"
+
+#include <type_traits>
+#include <vector>
+
+namespace cs{
+
+/*
+The delay network of the Reverb: predelay, four diffusion stages and the
+feedback delay together with the filters in the feedback loop. All delay
+memory is taken from the network's own arena. Networks of different channel
+counts share this interface, so the Reverb can swap between them.
+
+A network can hold several independent instances with the same model and
+parameters. Every stage keeps its instances next to each other and runs
+them back to back, and the filter coefficients are computed once for all.
+*/
+struct ReverbNetwork{
+public:
+    static constexpr unsigned STAGES = 5;
+    static constexpr unsigned MAX_INSTANCES = 4;
+    // Longest predelay, in seconds.
+    static constexpr float PREDELAY_LENGTH = 2.f;
+
+    virtual ~ReverbNetwork() {}
+
+    // Arena rows taken by one instance of the given channel count, line type
+    // and stage lengths (in seconds, STAGES times channels/4 vectors).
+    template <typename LINE>
+    static size_t arenaRows(unsigned channels, simd::float_4 const* lengths, float FS)
+    {
+        size_t rows = StereoDelayStage::arenaRows(PREDELAY_LENGTH, FS);
+        for(unsigned i = 0; i < STAGES*(channels/4); i++){
+            rows += DelayArena::roundUp(LINE::arenaRows(LINE::rows(lengths[i]*FS)));
+        }
+        return rows;
+    }
+
+    static size_t arenaRows(unsigned channels, bool compressed, simd::float_4 const* lengths, float FS)
+    {
+        if(compressed){
+            return arenaRows<Delay2H4i16>(channels, lengths, FS);
+        }
+        return arenaRows<Delay2H4>(channels, lengths, FS);
+    }
+
+    virtual unsigned getChannels(void) = 0;
+
+    virtual unsigned getInstances(void) = 0;
+
+    // Whether the diffusion and feedback lines store 16 bit samples.
+    virtual bool isCompressed(void) = 0;
+
+    // Rebuilds the network with silent lines, with one mixer type per stage.
+    // Only allocates if the arena is smaller than reserve_rows or than what
+    // the model needs for all instances.
+    virtual void configure(simd::float_4 const* lengths, simd::float_4 const* normals, MixerType const* mixers, float fs, size_t reserve_rows) = 0;
+
+    // Silences the lines and filters of one instance. It only touches state
+    // that process() keeps, so another thread can clear an instance that is
+    // not processed while the others run and the parameters are set.
+    virtual void clear(unsigned instance) = 0;
+
+    virtual float getSampleRate(void) = 0;
+
+    // Samples it takes a signal to leave every line of the network once.
+    virtual size_t getMemoryLength(void) = 0;
+
+    // Predelay in seconds, the other delay times relative to the line lengths.
+    virtual void setScales(float predelay_time, float diffusion_depth, float delay_scale) = 0;
+
+    // The shelving coefficients move to the new ones over `ramp` samples.
+    virtual void setShelves(float center, float low_gain, float high_gain, unsigned ramp = 1) = 0;
+
+    // Pitch shifts `amount` (0 to 1) of the feedback by `ratio`, so that the
+    // tail rises or falls with every pass. At zero the shifters are only fed.
+    virtual void setShimmer(float amount, float ratio) = 0;
+
+    // Processes instances 0 to count-1. Each takes a stereo pair in lanes
+    // (L, R, L, R) and returns the diffused signal before it enters the
+    // feedback delay, mixed down to four lanes.
+    virtual void process(simd::float_4 const* in, simd::float_4* out, unsigned count, float feedback) = 0;
+
+    simd::float_4 process(simd::float_4 in, float feedback)
+    {
+        simd::float_4 out;
+        process(&in, &out, 1, feedback);
+        return out;
+    }
+};
+
+template <unsigned N, typename LINE = Delay2H4>
+struct DiffusionNetwork : ReverbNetwork{
+    static constexpr unsigned GROUPS = N/4;
+    // Grain window and jitter of the shimmer, in seconds and window lengths.
+    static constexpr float SHIMMER_WINDOW = 0.08f;
+    static constexpr float SHIMMER_JITTER = 0.5f;
+
+private:
+    float FS;
+    unsigned instances;
+    size_t memory_length = 0;
+    // Keeps the level independent of the number of groups the input is fanned out to.
+    float group_gain = 1.f/std::sqrt((float)GROUPS);
+    DelayArena arena;
+    // One entry per instance. The last stage is the feedback delay.
+    std::vector<StereoDelayStage> predelay;
+    std::vector<DiffusionStage<N, LINE>> stages[STAGES];
+    // GROUPS entries per instance.
+    std::vector<OnePole<simd::float_4>> hp_filters;
+    std::vector<TwoShelves<simd::float_4>> two_shelves;
+    std::vector<simd::float_4> back_fed;
+    // Left and right shifter of each instance. While shimmer is off they
+    // are only fed, so turning it on needs no clearing on the audio thread.
+    std::vector<GrainShifter<4>> shifters;
+    float shimmer_gain = 0.f;
+    float shimmer_keep = 1.f;
+    float shimmer_ratio = 1.f;
+
+    static simd::float_4 const* zeros(void)
+    {
+        static simd::float_4 const z[STAGES*GROUPS] = {};
+        return z;
+    }
+
+    // Carves the lines of all instances from the arena, stage by stage.
+    void build(simd::float_4 const* lengths, simd::float_4 const* normals, MixerType const* mixers)
+    {
+        arena.reset();
+        predelay.clear();
+        for(unsigned k = 0; k < instances; k++){
+            predelay.push_back(StereoDelayStage(PREDELAY_LENGTH, FS, arena));
+        }
+        for(unsigned s = 0; s < STAGES; s++){
+            stages[s].clear();
+            for(unsigned k = 0; k < instances; k++){
+                stages[s].push_back(DiffusionStage<N, LINE>(lengths + s*GROUPS, normals + s*GROUPS, FS, arena, mixers[s]));
+            }
+        }
+    }
+
+public:
+    // An empty network, configure() has to be called before processing.
+    DiffusionNetwork(float FS = 48000.f, unsigned instances = 1)
+    : FS(FS),
+      instances(instances < 1 ? 1 : (instances > MAX_INSTANCES ? (unsigned)MAX_INSTANCES : instances)),
+      arena(this->instances*arenaRows<LINE>(N, zeros(), FS)),
+      hp_filters(GROUPS*this->instances, OnePole<simd::float_4>(FS)),
+      two_shelves(GROUPS*this->instances, TwoShelves<simd::float_4>(FS)),
+      back_fed(GROUPS*this->instances, simd::float_4::zero()),
+      shifters(2*this->instances)
+    {
+        static MixerType const householder[STAGES] = {};
+        predelay.reserve(this->instances);
+        for(unsigned s = 0; s < STAGES; s++){
+            stages[s].reserve(this->instances);
+        }
+        build(zeros(), zeros(), householder);
+    }
+
+    unsigned getChannels(void) override
+    {
+        return N;
+    }
+
+    unsigned getInstances(void) override
+    {
+        return instances;
+    }
+
+    bool isCompressed(void) override
+    {
+        return std::is_same<LINE, Delay2H4i16>::value;
+    }
+
+    void configure(simd::float_4 const* lengths, simd::float_4 const* normals, MixerType const* mixers, float fs, size_t reserve_rows) override
+    {
+        FS = fs;
+        arena.reserve(std::max(reserve_rows, instances*arenaRows<LINE>(N, lengths, FS)));
+        build(lengths, normals, mixers);
+
+        memory_length = (size_t)(PREDELAY_LENGTH*FS);
+        for(unsigned i = 0; i < STAGES; i++){
+            unsigned longest = 0;
+            for(unsigned g = 0; g < GROUPS; g++){
+                longest = std::max(longest, Delay2H4::rows(lengths[i*GROUPS + g]*FS));
+            }
+            memory_length += longest;
+        }
+
+        for(unsigned i = 0; i < 2*instances; i++){
+            shifters[i] = GrainShifter<4>(FS, SHIMMER_WINDOW, i + 1);
+            shifters[i].setJitter(SHIMMER_JITTER);
+            shifters[i].setRatio(shimmer_ratio);
+            shifters[i].reset();
+        }
+        memory_length += shifters[0].getLength();
+
+        for(unsigned i = 0; i < GROUPS*instances; i++){
+            back_fed[i] = simd::float_4::zero();
+            hp_filters[i] = OnePole<simd::float_4>(FS);
+            hp_filters[i].setFrequency(10.f);
+            two_shelves[i] = TwoShelves<simd::float_4>(FS);
+        }
+    }
+
+    void clear(unsigned instance) override
+    {
+        predelay[instance].clear();
+        for(unsigned s = 0; s < STAGES; s++){
+            stages[s][instance].clear();
+        }
+        for(unsigned i = instance*GROUPS; i < (instance + 1)*GROUPS; i++){
+            back_fed[i] = simd::float_4::zero();
+            hp_filters[i].z = simd::float_4::zero();
+            two_shelves[i].z = simd::float_4::zero();
+            two_shelves[i].in1 = simd::float_4::zero();
+        }
+        shifters[2*instance].clear();
+        shifters[2*instance + 1].clear();
+    }
+
+    float getSampleRate(void) override
+    {
+        return FS;
+    }
+
+    size_t getMemoryLength(void) override
+    {
+        return memory_length;
+    }
+
+    void setScales(float predelay_time, float diffusion_depth, float delay_scale) override
+    {
+        for(unsigned k = 0; k < instances; k++){
+            predelay[k].setScale(predelay_time/PREDELAY_LENGTH);
+            for(unsigned s = 0; s < STAGES - 1; s++){
+                stages[s][k].setScale(diffusion_depth);
+            }
+            stages[STAGES - 1][k].setScale(delay_scale);
+        }
+    }
+
+    void setShelves(float center, float low_gain, float high_gain, unsigned ramp = 1) override
+    {
+        // Instance 0 always runs, the others follow its coefficients.
+        two_shelves[0].rampParams(center, low_gain, high_gain, ramp);
+        for(unsigned i = 1; i < GROUPS*instances; i++){
+            two_shelves[i].copyParams(two_shelves[0]);
+        }
+    }
+
+    void setShimmer(float amount, float ratio) override
+    {
+        amount = clamp(amount, 0.f, 1.f);
+        // Linear, with the shifted part scaled by the shifters' largest gain,
+        // so the feedback loop never gains more than `feedback`. Equal power
+        // made 1.41 or more of signals the shifters pass unchanged, which
+        // diverged as long as the delay stages were short.
+        shimmer_gain = amount/shifters[0].getCoherentGain();
+        shimmer_keep = 1.f - amount;
+        if(ratio != shimmer_ratio){
+            shimmer_ratio = ratio;
+            for(GrainShifter<4>& shifter : shifters){
+                shifter.setRatio(ratio);
+            }
+        }
+    }
+
+    using ReverbNetwork::process;
+
+    void process(simd::float_4 const* in, simd::float_4* out, unsigned count, float feedback) override
+    {
+        count = (count < instances) ? count : instances;
+        simd::float_4 v[MAX_INSTANCES*GROUPS];
+        for(unsigned k = 0; k < count; k++){
+            simd::float_4 x = predelay[k].process(in[k][0], in[k][1]) * simd::float_4(group_gain);
+            for(unsigned i = k*GROUPS; i < (k + 1)*GROUPS; i++){
+                v[i] = x + back_fed[i];
+                v[i] = v[i] - hp_filters[i].process(v[i]);
+                v[i] = two_shelves[i].process(v[i]);
+            }
+        }
+        for(unsigned s = 0; s < STAGES - 1; s++){
+            for(unsigned k = 0; k < count; k++){
+                stages[s][k].process(v + k*GROUPS);
+            }
+        }
+
+        for(unsigned k = 0; k < count; k++){
+            simd::float_4 sum = v[k*GROUPS];
+            for(unsigned g = 1; g < GROUPS; g++){
+                sum += v[k*GROUPS + g];
+            }
+            out[k] = sum * simd::float_4(group_gain);
+        }
+
+        for(unsigned k = 0; k < count; k++){
+            stages[STAGES - 1][k].process(v + k*GROUPS);
+        }
+        if(shimmer_gain == 0.f){
+            for(unsigned i = 0; i < count*GROUPS; i++){
+                back_fed[i] = v[i] * simd::float_4(feedback);
+            }
+            for(unsigned k = 0; k < count; k++){
+                simd::float_4 sum = v[k*GROUPS];
+                for(unsigned g = 1; g < GROUPS; g++){
+                    sum += v[k*GROUPS + g];
+                }
+                sum *= simd::float_4(group_gain);
+                shifters[2*k].write(sum[0]);
+                shifters[2*k + 1].write(sum[1]);
+            }
+            return;
+        }
+
+        // The feedback delay's output is mixed down like `out`, shifted, and
+        // fanned back out to the groups next to the unshifted feedback.
+        for(unsigned k = 0; k < count; k++){
+            simd::float_4 sum = v[k*GROUPS];
+            for(unsigned g = 1; g < GROUPS; g++){
+                sum += v[k*GROUPS + g];
+            }
+            sum *= simd::float_4(group_gain);
+            float left = shifters[2*k].process(sum[0]);
+            float right = shifters[2*k + 1].process(sum[1]);
+            simd::float_4 shifted = simd::float_4(left, right, left, right) * simd::float_4(shimmer_gain*group_gain*feedback);
+            for(unsigned i = k*GROUPS; i < (k + 1)*GROUPS; i++){
+                back_fed[i] = v[i] * simd::float_4(shimmer_keep*feedback) + shifted;
+            }
+        }
+    }
+};
+
+template <typename LINE>
+inline ReverbNetwork* createReverbNetwork(unsigned channels, unsigned instances, float FS)
+{
+    switch(channels){
+    case 4:
+        return new DiffusionNetwork<4, LINE>(FS, instances);
+    case 8:
+        return new DiffusionNetwork<8, LINE>(FS, instances);
+    case 16:
+        return new DiffusionNetwork<16, LINE>(FS, instances);
+    default:
+        return nullptr;
+    }
+}
+
+// A network of 4, 8 or 16 channels, nullptr for any other count.
+inline ReverbNetwork* createReverbNetwork(unsigned channels, bool compressed, unsigned instances, float FS)
+{
+    if(compressed){
+        return createReverbNetwork<Delay2H4i16>(channels, instances, FS);
+    }
+    return createReverbNetwork<Delay2H4>(channels, instances, FS);
+}
+
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "rack.hpp"
+
 namespace cs{
 
     inline float sigmoid(float signal)
@@ -23,4 +25,14 @@ namespace cs{
         float B_coef = 1.f - A_coef;                    // mixing down
         return A*A_coef + B*B_coef;
     }
+
+    // The crossfade index is shared by all lanes, so the smoothstep is evaluated once.
+    inline simd::float_4 xfade(simd::float_4 A, simd::float_4 B, float index)
+    {
+        if(index >= 1.f){
+            return A;
+        }
+        float A_coef = index*index*(3.f - 2.f*index);
+        return B + (A - B)*simd::float_4(A_coef);
+    }
 }
\ No newline at end of file
@@ -60,50 +60,343 @@ struct SimpleSvf {
     }
 };
 
-template <typename T, unsigned N>
+inline bool anyTrue(bool mask) {
+    return mask;
+}
+
+inline bool anyTrue(simd::float_4 mask) {
+    return simd::movemask(mask);
+}
+
+/*
+Cutoff ratios for a chain of stages spread evenly over `spread` octaves
+around the base frequency. Computed multiplicatively, one exp2 per chain.
+*/
+struct SpreadRatio {
+    float ratio = 1.f;
+    float step = 1.f;
+
+    SpreadRatio(float spread, unsigned depth) {
+        if (depth > 1) {
+            ratio = std::exp2(-0.5f*spread);
+            step = std::exp2(spread/(float)(depth - 1));
+        }
+    }
+
+    float next(void) {
+        float ret = ratio;
+        ratio *= step;
+        return ret;
+    }
+};
+
+/*
+Chain of N SVF allpass stages with per-stage cutoffs. Up to BANKS
+independent channel groups can be run together: the stages are stored
+stage-major with the banks of one stage next to each other, and the banks
+are stepped through each stage side by side so that their dependency chains
+overlap instead of running one after another.
+
+A cutoff is one tan per stage, too much to pay per sample for a deep chain.
+Modulated controls are meant to be set every few samples with rampParams(),
+which moves every coefficient linearly to its new value in the meantime.
+Without spread all stages share one cutoff, and so one tan.
+*/
+template <typename T, unsigned N, unsigned BANKS = 1>
 struct SeriesAllpass {
+    // Coefficients next to the state they act on.
+    struct alignas(16) Stage {
+        T g = 0.f;
+        T d = 1.f;
+        T m1 = 0.f;
+        T m2 = 0.f;
+        // Added to g and d every sample while the coefficients ramp.
+        T g_step = 0.f;
+        T d_step = 0.f;
+    };
 
     T Ts;
     T Flimit;
-    T g;
-    T R;
+    T R[BANKS];
+    T R_step[BANKS];
+    unsigned ramp_left[BANKS];
+    T out[BANKS];
 
-    T m1[N] = {0.f};
-    T m2[N] = {0.f};
+    Stage stages[N][BANKS];
+    unsigned depth = N;
 
-    T hp[N] = {0.f};
-    T bp[N] = {0.f};
-    T lp[N] = {0.f};
-
-    T signal[N] = {0.f};
+    T freq_z[BANKS];
+    T Q_z[BANKS];
+    float spread_z[BANKS];
+    unsigned depth_z[BANKS];
     
-    SeriesAllpass(T FS) : Ts(T(1.f/FS)), Flimit(T(0.45f*FS)), g(simd::tan(T(M_PI*100.f)*Ts)), R(T(1.f)) {}
+    SeriesAllpass(T FS) : Ts(T(1.f/FS)), Flimit(T(0.45f*FS))
+    {
+        for(unsigned b = 0; b < BANKS; b++){
+            R[b] = T(1.f);
+            out[b] = T(0.f);
+            freq_z[b] = T(-1.f);
+            Q_z[b] = T(-1.f);
+            spread_z[b] = -1.f;
+            depth_z[b] = 0;
+            setParams(T(100.f), T(1.f), 0.f, N, b);
+            // The first ramp starts at the controls rather than at this default.
+            freq_z[b] = T(-1.f);
+        }
+    }
 
-    void setParams(T freq, T Q) {
+    void setParams(T freq, T Q, float spread = 0.f, unsigned new_depth = N, unsigned bank = 0) {
+        rampParams(freq, Q, spread, new_depth, bank, 1);
+    }
+
+    // Stage coefficients are only recomputed when one of the controls changed,
+    // they reach the new values after `steps` samples. The first call of a
+    // bank does not ramp. The depth is shared by all banks.
+    void rampParams(T freq, T Q, float spread, unsigned new_depth, unsigned bank, unsigned steps) {
         Q = simd::ifelse(Q < 0.5f, 0.5f, Q);
         freq = simd::ifelse(freq <= 0.f, 0.f, freq);
         freq = simd::ifelse(freq >= Flimit, Flimit, freq);
+        if (new_depth > N) new_depth = N;
+        if (new_depth == 0) new_depth = 1;
+        depth = new_depth;
 
-        R = T(1.f)/Q;
-        g = simd::tan(T(M_PI)*freq*Ts);
+        if (!anyTrue(freq != freq_z[bank]) && !anyTrue(Q != Q_z[bank]) && spread == spread_z[bank] && depth == depth_z[bank]) return;
+        if (anyTrue(freq_z[bank] < T(0.f))) steps = 1;
+        freq_z[bank] = freq;
+        Q_z[bank] = Q;
+        spread_z[bank] = spread;
+        depth_z[bank] = depth;
+
+        T R_new = T(1.f)/Q;
+        T scale = T(1.f/steps);
+        ramp_left[bank] = steps > 1 ? steps : 0;
+        R_step[bank] = (R_new - R[bank])*scale;
+        if (steps <= 1) R[bank] = R_new;
+
+        bool shared = spread == 0.f || depth == 1;
+        T g = simd::tan(T(M_PI)*freq*Ts);
+        T d = T(1.f)/(g*g + T(2.f)*g*R_new + T(1.f));
+        SpreadRatio ratio(spread, depth);
+        for(unsigned i = 0; i < depth; i++){
+            if (!shared) {
+                T f = simd::fmin(freq*T(ratio.next()), Flimit);
+                g = simd::tan(T(M_PI)*f*Ts);
+                d = T(1.f)/(g*g + T(2.f)*g*R_new + T(1.f));
+            }
+            Stage& s = stages[i][bank];
+            if (steps > 1) {
+                s.g_step = (g - s.g)*scale;
+                s.d_step = (d - s.d)*scale;
+            }
+            else {
+                s.g = g;
+                s.d = d;
+            }
+        }
+    }
+
+    void process(T in) {
+        processBanks<1>(&in);
+    }
+
+    // Runs the first `banks` banks, in[b] being the input of bank b.
+    void process(T const* in, unsigned banks) {
+        switch(banks){
+        case 0: break;
+        case 1: processBanks<1>(in); break;
+        case 2: processBanks<(BANKS < 2) ? BANKS : 2>(in); break;
+        case 3: processBanks<(BANKS < 3) ? BANKS : 3>(in); break;
+        default: processBanks<(BANKS < 4) ? BANKS : 4>(in); break;
+        };
+    }
+
+    T getAllPass(unsigned bank = 0) {
+        return out[bank];
+    }
+
+private:
+    template <unsigned B>
+    void processBanks(T const* in) {
+        bool ramping = false;
+        for(unsigned b = 0; b < B; b++){
+            ramping = ramping || ramp_left[b];
+        }
+        if (ramping) {
+            processStages<B, true>(in);
+        }
+        else {
+            processStages<B, false>(in);
+        }
     }
 
-    void process(T in, unsigned depth) {
-        if (depth > N) depth = N;
+    template <unsigned B, bool RAMP>
+    void processStages(T const* in) {
+        T x[B];
+        T R2[B];
+        bool ramp[B];
+        for(unsigned b = 0; b < B; b++){
+            ramp[b] = RAMP && ramp_left[b];
+            if (ramp[b]) {
+                ramp_left[b]--;
+                R[b] += R_step[b];
+            }
+            x[b] = in[b];
+            R2[b] = T(2.f)*R[b];
+        }
         for(unsigned i = 0; i < depth; i++){
-            signal[i] = in;
-            hp[i] = (in-(g + T(2.f)*R)*m1[i] - m2[i])/(g*g + T(2.f)*g*R + T(1.f));
-            bp[i] = g*hp[i] + m1[i];
-            lp[i] = g*bp[i] + m2[i];
-            m1[i] = g*hp[i] + bp[i];
-            m2[i] = g*bp[i] + lp[i];
-            in = T(2.f)*(hp[i]+lp[i])-signal[i];
+            for(unsigned b = 0; b < B; b++){
+                Stage& s = stages[i][b];
+                if (RAMP && ramp[b]) {
+                    s.g += s.g_step;
+                    s.d += s.d_step;
+                }
+                T hp = (x[b] - (s.g + R2[b])*s.m1 - s.m2)*s.d;
+                T bp = s.g*hp + s.m1;
+                T lp = s.g*bp + s.m2;
+                s.m1 = s.g*hp + bp;
+                s.m2 = s.g*bp + lp;
+                x[b] = T(2.f)*(hp + lp) - x[b];
+            }
+        }
+        for(unsigned b = 0; b < B; b++){
+            out[b] = x[b];
         }
     }
+};
+
+/*
+Mono variant of SeriesAllpass which spreads the stages over the four lanes
+of a float_4. Lane k runs its own consecutive group of stages and passes its
+output to lane k+1 on the next sample, so all lanes are busy at the cost of
+LATENCY samples of delay.
+*/
+template <unsigned N>
+struct PipelinedAllpass {
+    static constexpr unsigned LANES = 4;
+    static constexpr unsigned LATENCY = LANES - 1;
+    static constexpr unsigned STAGES = (N + LANES - 1) / LANES;
+
+    typedef typename SeriesAllpass<simd::float_4, STAGES>::Stage Stage;
+
+    float Ts;
+    float Flimit;
+    float R = 1.f;
+    float R_step = 0.f;
+    unsigned ramp_left = 0;
+
+    Stage stages[STAGES];
+    unsigned depth = 1;
+    unsigned stages_used = 1;
+    simd::float_4 last_active = simd::float_4::mask();
+
+    float freq_z = -1.f;
+    float Q_z = -1.f;
+    float spread_z = -1.f;
+
+    simd::float_4 lanes_out = 0.f;
+    float dry[LATENCY] = {};
+    unsigned dry_index = 0;
+    float dry_out = 0.f;
+
+    PipelinedAllpass(float FS) : Ts(1.f/FS), Flimit(0.45f*FS)
+    {
+        setParams(100.f, 1.f, 0.f, N);
+        freq_z = -1.f;
+    }
+
+    void setParams(float freq, float Q, float spread = 0.f, unsigned new_depth = N) {
+        rampParams(freq, Q, spread, new_depth, 1);
+    }
+
+    // Same as SeriesAllpass::rampParams().
+    void rampParams(float freq, float Q, float spread, unsigned new_depth, unsigned steps) {
+        if (Q < 0.5f) Q = 0.5f;
+        if (freq <= 0.f) freq = 0.f;
+        if (freq >= Flimit) freq = Flimit;
+        if (new_depth > N) new_depth = N;
+        if (new_depth == 0) new_depth = 1;
+
+        if (freq == freq_z && Q == Q_z && spread == spread_z && new_depth == depth) return;
+        if (freq_z < 0.f) steps = 1;
+        freq_z = freq;
+        Q_z = Q;
+        spread_z = spread;
+        depth = new_depth;
+
+        // The first full_lanes lanes run stages_used stages, the rest one less.
+        stages_used = (depth + LANES - 1) / LANES;
+        unsigned full_lanes = depth - LANES*(stages_used - 1);
+        last_active = simd::float_4(0.f, 1.f, 2.f, 3.f) < simd::float_4(full_lanes);
+
+        float R_new = 1.f/Q;
+        float scale = 1.f/steps;
+        ramp_left = steps > 1 ? steps : 0;
+        R_step = (R_new - R)*scale;
+        if (steps <= 1) R = R_new;
+
+        bool shared = spread == 0.f || depth == 1;
+        float g = std::tan(float(M_PI)*freq*Ts);
+        float d = 1.f/(g*g + 2.f*g*R_new + 1.f);
+        SpreadRatio ratio(spread, depth);
+        for (unsigned lane = 0; lane < LANES; lane++) {
+            unsigned lane_stages = (lane < full_lanes) ? stages_used : stages_used - 1;
+            for (unsigned i = 0; i < stages_used; i++) {
+                Stage& s = stages[i];
+                if (i < lane_stages && !shared) {
+                    g = std::tan(float(M_PI)*std::fmin(freq*ratio.next(), Flimit)*Ts);
+                    d = 1.f/(g*g + 2.f*g*R_new + 1.f);
+                }
+                // A lane's unused last stage keeps its coefficients.
+                float g_target = i < lane_stages ? g : s.g[lane];
+                float d_target = i < lane_stages ? d : s.d[lane];
+                if (steps > 1) {
+                    s.g_step[lane] = (g_target - s.g[lane])*scale;
+                    s.d_step[lane] = (d_target - s.d[lane])*scale;
+                }
+                else {
+                    s.g[lane] = g_target;
+                    s.d[lane] = d_target;
+                }
+            }
+        }
+    }
+
+    void process(float in) {
+        dry_out = dry[dry_index];
+        dry[dry_index] = in;
+        if (++dry_index >= LATENCY) dry_index = 0;
+
+        bool ramp = ramp_left;
+        if (ramp) {
+            ramp_left--;
+            R += R_step;
+        }
+        simd::float_4 const R2 = simd::float_4(2.f*R);
+        simd::float_4 x = simd::float_4(in, lanes_out[0], lanes_out[1], lanes_out[2]);
+        for (unsigned i = 0; i < stages_used; i++) {
+            Stage& s = stages[i];
+            if (ramp) {
+                s.g += s.g_step;
+                s.d += s.d_step;
+            }
+            simd::float_4 hp = (x - (s.g + R2)*s.m1 - s.m2)*s.d;
+            simd::float_4 bp = s.g*hp + s.m1;
+            simd::float_4 lp = s.g*bp + s.m2;
+            s.m1 = s.g*hp + bp;
+            s.m2 = s.g*bp + lp;
+            simd::float_4 y = simd::float_4(2.f)*(hp + lp) - x;
+            x = (i == stages_used - 1) ? simd::ifelse(last_active, y, x) : y;
+        }
+        lanes_out = x;
+    }
+
+    float getAllPass(void) {
+        return lanes_out[LANES - 1];
+    }
 
-    T getAllPass(unsigned depth) {
-        if (depth > N || depth == 0) return T(0.f);
-        return T(2.f)*(hp[depth-1]+lp[depth-1])-signal[depth-1];
+    // Input sample aligned with getAllPass(), for dry/wet mixing.
+    float getDry(void) {
+        return dry_out;
     }
 };
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "plugin.hpp"
+#include "components/channel_bank.hpp"
 #include "components/simple_svf.hpp"
 
 using simd::float_4;
@@ -11,6 +12,7 @@ struct Dispersion : Module {
 		Q_MOD_DEPTH_PARAM,
 		DEPTH_PARAM,
 		DRY_PARAM,
+		SPREAD_PARAM,
 		PARAMS_LEN
 	};
 	enum InputId {
@@ -28,11 +30,25 @@ struct Dispersion : Module {
 		LIGHTS_LEN
 	};
 
-	#define M 32
-	cs::SeriesAllpass<float_4, M> filter;
+	#define M 256
+	cs::SeriesAllpass<float_4, M, cs::MAX_CHANNEL_BANKS> filter;
+	cs::PipelinedAllpass<M> mono_filter;
+	bool pipelined = false;
+
+	// Cutoff, Q and depth are evaluated every sample while the stages share
+	// their coefficients (no spread), which costs one tan per bank, and while
+	// the linear FM input runs at audio rate. Otherwise they are evaluated
+	// once every CONTROL_PERIOD samples and the coefficients ramp to them over
+	// the period. A change of the channel count or the mono mode evaluates
+	// them right away.
+	static constexpr unsigned CONTROL_PERIOD = 16;
+	unsigned control_phase = 0;
+	unsigned control_banks = 0;
+	bool control_mono = false;
 
 	Dispersion()
-	: filter (cs::SeriesAllpass<float_4, M>(48000.f))
+	: filter (cs::SeriesAllpass<float_4, M, cs::MAX_CHANNEL_BANKS>(48000.f)),
+	  mono_filter (cs::PipelinedAllpass<M>(48000.f))
 	{
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
 		configParam(FREQUENCY_PARAM, std::log2(10.f), std::log2(24000.f), std::log2(dsp::FREQ_C4), "Frequency", "Hz", 2);
@@ -41,6 +57,7 @@ struct Dispersion : Module {
 		configParam(Q_MOD_DEPTH_PARAM, -1.f, 1.f, 0.f, "Q mod. depth");
 		configParam(DEPTH_PARAM, 1.f, float(M), 1.f, "Depth");
 		configParam(DRY_PARAM, 0.f, 1.f, 0.f, "Dry mix");
+		configParam(SPREAD_PARAM, 0.f, 8.f, 0.f, "Frequency spread", " oct");
 		configInput(F_MOD_INPUT, "Linear FM");
 		configInput(VPOCT_INPUT, "V/Oct");
 		configInput(Q_MOD_INPUT, "Q mod.");
@@ -51,36 +68,87 @@ struct Dispersion : Module {
 		configBypass(SIGNAL_INPUT, SIGNAL_OUTPUT);
 	}
 
+	void setControls(const ProcessArgs& args, unsigned banks, bool mono, unsigned steps)
+	{
+		float freq_knob = params[FREQUENCY_PARAM].getValue();
+		float f_mod_depth = 5000.f * args.sampleTime * dsp::cubic(params[F_MOD_DEPTH_PARAM].getValue());
+		float q_knob = dsp::quintic(params[Q_PARAM].getValue());
+		float q_mod_depth = dsp::cubic(params[Q_MOD_DEPTH_PARAM].getValue());
+		unsigned depth = (unsigned)params[DEPTH_PARAM].getValue();
+		float spread = params[SPREAD_PARAM].getValue();
+
+		for(unsigned b = 0; b < banks; b++){
+			unsigned c = 4*b;
+			float_4 vpoct = inputs[VPOCT_INPUT].getPolyVoltageSimd<float_4>(c);
+			float_4 freq_tuning = dsp::approxExp2_taylor5(freq_knob + vpoct);
+			float_4 f_mod = args.sampleRate * 0.1f * inputs[F_MOD_INPUT].getPolyVoltageSimd<float_4>(c);
+			float_4 cutoff_param = freq_tuning + f_mod_depth * f_mod;
+			float_4 q_mod = 0.1f * inputs[Q_MOD_INPUT].getPolyVoltageSimd<float_4>(c);
+			float_4 reso_param = float_4(q_knob + q_mod_depth * q_mod);
+			reso_param = rescale(reso_param, 0.f, 1.f, 0.5f, 10.f);
+
+			if(mono){
+				mono_filter.rampParams(cutoff_param[0], reso_param[0], spread, depth, steps);
+				return;
+			}
+			filter.rampParams(cutoff_param, reso_param, spread, depth, b, steps);
+		}
+	}
+
 	void process(const ProcessArgs& args) override {
 		unsigned num_channels = std::max<unsigned>(inputs[SIGNAL_INPUT].getChannels(), inputs[VPOCT_INPUT].getChannels());
 		num_channels = std::max<unsigned>(num_channels, inputs[F_MOD_INPUT].getChannels());
 		num_channels = std::max<unsigned>(num_channels, inputs[Q_MOD_INPUT].getChannels());
-		num_channels = std::min<unsigned>(num_channels, 4);
+		num_channels = cs::clampChannels(num_channels);
+		unsigned banks = cs::channelBanks(num_channels);
 		outputs[SIGNAL_OUTPUT].setChannels(num_channels);
 
-		float freq_knob = params[FREQUENCY_PARAM].getValue();
-		float_4 vpoct = inputs[VPOCT_INPUT].getPolyVoltageSimd<float_4>(0);
-		float_4 freq_tuning = dsp::approxExp2_taylor5(freq_knob + vpoct);
-		float f_mod_depth = 5000.f * args.sampleTime * dsp::cubic(params[F_MOD_DEPTH_PARAM].getValue());
-		float_4 f_mod = args.sampleRate * 0.1f * inputs[F_MOD_INPUT].getPolyVoltageSimd<float_4>(0);
-		float_4 cutoff_param = freq_tuning + f_mod_depth * f_mod;
-		float q_knob = dsp::quintic(params[Q_PARAM].getValue());
-		float q_mod_depth = dsp::cubic(params[Q_MOD_DEPTH_PARAM].getValue());
-		float_4 q_mod = 0.1f * inputs[Q_MOD_INPUT].getPolyVoltageSimd<float_4>(0);
-		float_4 reso_param = float_4(q_knob + q_mod_depth * q_mod);
-		reso_param = rescale(reso_param, 0.f, 1.f, 0.5f, 10.f);
-		
-		filter.setParams(cutoff_param, reso_param);
-		float_4 in = inputs[SIGNAL_INPUT].getPolyVoltageSimd<float_4>(0);
-		unsigned char depth = (unsigned)params[DEPTH_PARAM].getValue();
-		filter.process(in, depth);
+		bool mono = pipelined && num_channels <= 1;
+		bool audio_rate = params[SPREAD_PARAM].getValue() == 0.f || inputs[F_MOD_INPUT].isConnected();
+		if(audio_rate || control_phase == 0 || banks != control_banks || mono != control_mono){
+			setControls(args, banks, mono, audio_rate ? 1 : CONTROL_PERIOD);
+			control_banks = banks;
+			control_mono = mono;
+			control_phase = 0;
+		}
+		control_phase = (control_phase + 1 >= CONTROL_PERIOD) ? 0 : control_phase + 1;
+
 		float dry_level = params[DRY_PARAM].getValue();
-		outputs[SIGNAL_OUTPUT].setVoltageSimd<float_4>(filter.getAllPass(depth) + dry_level * in, 0);
+		if(mono){
+			mono_filter.process(inputs[SIGNAL_INPUT].getVoltage());
+			outputs[SIGNAL_OUTPUT].setVoltage(mono_filter.getAllPass() + dry_level * mono_filter.getDry());
+			return;
+		}
+
+		float_4 in[cs::MAX_CHANNEL_BANKS];
+		for(unsigned b = 0; b < banks; b++){
+			in[b] = inputs[SIGNAL_INPUT].getPolyVoltageSimd<float_4>(4*b);
+		}
+		// The banks run side by side through the chain.
+		filter.process(in, banks);
+		for(unsigned b = 0; b < banks; b++){
+			outputs[SIGNAL_OUTPUT].setVoltageSimd<float_4>(filter.getAllPass(b) + dry_level * in[b], 4*b);
+		}
 	}
 
 	void onSampleRateChange(const SampleRateChangeEvent& e) override
 	{
-		filter = cs::SeriesAllpass<float_4, M>(e.sampleRate);
+		filter = cs::SeriesAllpass<float_4, M, cs::MAX_CHANNEL_BANKS>(e.sampleRate);
+		mono_filter = cs::PipelinedAllpass<M>(e.sampleRate);
+		control_phase = 0;
+	}
+
+	json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+		json_object_set_new(rootJ, "pipelined", json_boolean(pipelined));
+		return rootJ;
+	}
+
+	void dataFromJson(json_t* rootJ) override {
+		json_t* pipelinedJ = json_object_get(rootJ, "pipelined");
+		if (pipelinedJ) {
+			pipelined = json_boolean_value(pipelinedJ);
+		}
 	}
 };
 
@@ -104,6 +172,32 @@ struct DispersionWidget : ModuleWidget {
 
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(30.48, 110.486)), module, Dispersion::SIGNAL_OUTPUT));
 	}
+
+	void appendContextMenu(Menu* menu) override {
+		Dispersion* module = dynamic_cast<Dispersion*>(this->module);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Frequency spread"));
+		ui::Slider* spread_slider = new ui::Slider;
+		spread_slider->quantity = module->getParamQuantity(Dispersion::SPREAD_PARAM);
+		spread_slider->box.size.x = 200.f;
+		menu->addChild(spread_slider);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Mono processing"));
+
+		struct PipelinedItem : MenuItem {
+			Dispersion* module;
+			void onAction(const event::Action& e) override {
+				module->pipelined ^= true;
+			}
+		};
+
+		PipelinedItem* pipelined_item = createMenuItem<PipelinedItem>(string::f("Pipelined (%u samples latency)", cs::PipelinedAllpass<M>::LATENCY));
+		pipelined_item->rightText = CHECKMARK(module->pipelined);
+		pipelined_item->module = module;
+		menu->addChild(pipelined_item);
+	}
 };
 
 
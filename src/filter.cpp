@@ -1,5 +1,6 @@
 #include "plugin.hpp"
 
+#include "components/channel_bank.hpp"
 #include "components/simple_svf.hpp"
 #include "components/tuned_envelope.hpp"
 
@@ -41,18 +42,26 @@ struct Filter : Module {
 	};
 	unsigned num_of_poles = TWO;
 
-	cs::SimpleSvf<float_4> filter_base;
-	cs::SimpleSvf<float_4> filter_low;
-	cs::SimpleSvf<float_4> filter_band;
-	cs::SimpleSvf<float_4> filter_high;
-	cs::TriggerProcessor<float_4> ping_trigger;
-	cs::TunedDecayEnvelope<float_4> ping_envelope;
+	// Filters and ping envelope of four channels.
+	struct Section {
+		cs::SimpleSvf<float_4> filter_base;
+		cs::SimpleSvf<float_4> filter_low;
+		cs::SimpleSvf<float_4> filter_band;
+		cs::SimpleSvf<float_4> filter_high;
+		cs::TriggerProcessor<float_4> ping_trigger;
+		cs::TunedDecayEnvelope<float_4> ping_envelope;
+
+		Section(float FS = 48000.f)
+		: filter_base(cs::SimpleSvf<float_4>(FS)),
+		  filter_low(cs::SimpleSvf<float_4>(FS)),
+		  filter_band(cs::SimpleSvf<float_4>(FS)),
+		  filter_high(cs::SimpleSvf<float_4>(FS))
+		{}
+	};
+
+	cs::ChannelBank<Section> sections;
 
 	Filter()
-	: filter_base(cs::SimpleSvf<float_4>(48000.f)), 
-	  filter_low(cs::SimpleSvf<float_4>(48000.f)), 
-	  filter_band(cs::SimpleSvf<float_4>(48000.f)), 
-	  filter_high(cs::SimpleSvf<float_4>(48000.f))
 	{
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
 		configSwitch(RESO_MODE_PARAM, 0.f, 1.f, 0.f, "Resonator mode");
@@ -81,75 +90,81 @@ struct Filter : Module {
 		num_channels = std::max<unsigned>(num_channels, inputs[F_MOD_INPUT].getChannels());
 		num_channels = std::max<unsigned>(num_channels, inputs[Q_MOD_INPUT].getChannels());
 		num_channels = std::max<unsigned>(num_channels, inputs[PING_INPUT].getChannels());
-		num_channels = std::min<unsigned>(num_channels, 4);
-		outputs[LOW_PASS_OUTPUT].setChannels(num_channels);
-		outputs[BAND_PASS_OUTPUT].setChannels(num_channels);
-		outputs[HIGH_PASS_OUTPUT].setChannels(num_channels);
+		unsigned banks = sections.setChannels(num_channels);
+		outputs[LOW_PASS_OUTPUT].setChannels(sections.getChannels());
+		outputs[BAND_PASS_OUTPUT].setChannels(sections.getChannels());
+		outputs[HIGH_PASS_OUTPUT].setChannels(sections.getChannels());
+
+		bool reso_mode = params[RESO_MODE_PARAM].getValue() > 0.f;
+		lights[RESO_MODE_LIGHT].setBrightness(reso_mode);
 
+		for(unsigned b = 0; b < banks; b++){
+			processSection(args, sections[b], 4*b, reso_mode);
+		}
+	}
+
+	void processSection(const ProcessArgs& args, Section& section, unsigned c, bool reso_mode)
+	{
 		float freq_knob = params[FREQUENCY_PARAM].getValue();
-		float_4 vpoct = inputs[VPOCT_INPUT].getPolyVoltageSimd<float_4>(0);
+		float_4 vpoct = inputs[VPOCT_INPUT].getPolyVoltageSimd<float_4>(c);
 		float_4 freq_tuning = dsp::approxExp2_taylor5(freq_knob + vpoct);
 		float f_mod_depth = 5000.f * args.sampleTime * dsp::cubic(params[F_MOD_DEPTH_PARAM].getValue());
-		float_4 f_mod = args.sampleRate * 0.1f * inputs[F_MOD_INPUT].getPolyVoltageSimd<float_4>(0);
+		float_4 f_mod = args.sampleRate * 0.1f * inputs[F_MOD_INPUT].getPolyVoltageSimd<float_4>(c);
 		float_4 cutoff_param = freq_tuning + f_mod_depth * f_mod;
 		float q_knob = dsp::quintic(params[Q_PARAM].getValue());
 		float q_mod_depth = dsp::cubic(params[Q_MOD_DEPTH_PARAM].getValue());
-		float_4 q_mod = 0.1f * inputs[Q_MOD_INPUT].getPolyVoltageSimd<float_4>(0);
+		float_4 q_mod = 0.1f * inputs[Q_MOD_INPUT].getPolyVoltageSimd<float_4>(c);
 		float_4 reso_param = float_4(q_knob + q_mod_depth * q_mod);
 
-		bool reso_mode = params[RESO_MODE_PARAM].getValue() > 0.f;
-		lights[RESO_MODE_LIGHT].setBrightness(reso_mode);
 		if(reso_mode){
 			reso_param *= 10.f*freq_tuning;
 		}
 		else{
 			reso_param = rescale(reso_param, 0.f, 1.f, 1.f, 1000.f);
 		}
-		ping_envelope.setFrequency(cutoff_param);
-		float_4 ping_level = inputs[PING_INPUT].getPolyVoltageSimd<float_4>(0);
-		float_4 pulse = ping_envelope.process(args.sampleTime, ping_trigger.process(ping_level));
-		float_4 in = inputs[SIGNAL_INPUT].getPolyVoltageSimd<float_4>(0);
+		section.ping_envelope.setFrequency(cutoff_param);
+		float_4 ping_level = inputs[PING_INPUT].getPolyVoltageSimd<float_4>(c);
+		float_4 pulse = section.ping_envelope.process(args.sampleTime, section.ping_trigger.process(ping_level));
+		float_4 in = inputs[SIGNAL_INPUT].getPolyVoltageSimd<float_4>(c);
 		float_4 dry = float_4(params[DRY_PARAM].getValue());
 
 		float_4 sqrt_reso_param = simd::ifelse(reso_param < 1.f, 1.f, simd::sqrt(reso_param));
 
+		cs::SimpleSvf<float_4>& filter_base = section.filter_base;
 		switch(num_of_poles){
 			default:
 			case FOUR:
 				filter_base.setParams(cutoff_param, sqrt_reso_param);
 				filter_base.process(in);
 				if(outputs[LOW_PASS_OUTPUT].isConnected()){
-					filter_low.setParams(cutoff_param, sqrt_reso_param);
-					filter_low.process(filter_base.getLowPass() + sqrt_reso_param*pulse);
-					outputs[LOW_PASS_OUTPUT].setVoltageSimd<float_4>(filter_low.getLowPass() + dry*in, 0);
+					section.filter_low.setParams(cutoff_param, sqrt_reso_param);
+					section.filter_low.process(filter_base.getLowPass() + sqrt_reso_param*pulse);
+					outputs[LOW_PASS_OUTPUT].setVoltageSimd<float_4>(section.filter_low.getLowPass() + dry*in, c);
 				}
 				if(outputs[BAND_PASS_OUTPUT].isConnected()){
-					filter_band.setParams(cutoff_param, sqrt_reso_param);
-					filter_band.process(2.f*filter_base.getBandPass() + sqrt_reso_param*pulse);
-					outputs[BAND_PASS_OUTPUT].setVoltageSimd<float_4>(filter_band.getBandPass() + dry*in, 0);
+					section.filter_band.setParams(cutoff_param, sqrt_reso_param);
+					section.filter_band.process(2.f*filter_base.getBandPass() + sqrt_reso_param*pulse);
+					outputs[BAND_PASS_OUTPUT].setVoltageSimd<float_4>(section.filter_band.getBandPass() + dry*in, c);
 				}
 				if(outputs[HIGH_PASS_OUTPUT].isConnected()){
-					filter_high.setParams(cutoff_param, sqrt_reso_param);
-					filter_high.process(filter_base.getHighPass() + sqrt_reso_param*pulse);
-					outputs[HIGH_PASS_OUTPUT].setVoltageSimd<float_4>(filter_high.getHighPass() + dry*in, 0);
+					section.filter_high.setParams(cutoff_param, sqrt_reso_param);
+					section.filter_high.process(filter_base.getHighPass() + sqrt_reso_param*pulse);
+					outputs[HIGH_PASS_OUTPUT].setVoltageSimd<float_4>(section.filter_high.getHighPass() + dry*in, c);
 				}
 			break;
 			case TWO:
 				filter_base.setParams(cutoff_param, reso_param);
 				filter_base.process(in + sqrt_reso_param*pulse);
-				outputs[LOW_PASS_OUTPUT].setVoltageSimd<float_4>(filter_base.getLowPass() + dry*in, 0);
-				outputs[BAND_PASS_OUTPUT].setVoltageSimd<float_4>(simd::sqrt(2.f)*filter_base.getBandPass() + dry*in, 0);
-				outputs[HIGH_PASS_OUTPUT].setVoltageSimd<float_4>(filter_base.getHighPass() + dry*in, 0);
+				outputs[LOW_PASS_OUTPUT].setVoltageSimd<float_4>(filter_base.getLowPass() + dry*in, c);
+				outputs[BAND_PASS_OUTPUT].setVoltageSimd<float_4>(simd::sqrt(2.f)*filter_base.getBandPass() + dry*in, c);
+				outputs[HIGH_PASS_OUTPUT].setVoltageSimd<float_4>(filter_base.getHighPass() + dry*in, c);
 			break;
 		}
 	}
 
 	void onSampleRateChange(const SampleRateChangeEvent& e) override
 	{
-		filter_base = cs::SimpleSvf<float_4>(e.sampleRate);
-		filter_low = cs::SimpleSvf<float_4>(e.sampleRate);
-		filter_band = cs::SimpleSvf<float_4>(e.sampleRate);
-		filter_high = cs::SimpleSvf<float_4>(e.sampleRate);
+		sections = cs::ChannelBank<Section>(Section(e.sampleRate));
 	}
 
 	json_t* dataToJson() override {
@@ -0,0 +1,171 @@
+#include "plugin.hpp"
+
+#include "components/filter_bank.hpp"
+
+using simd::float_4;
+
+/*
+A bank of 4, 8 or 16 band pass filters (context menu) splitting the range
+between the low and high knobs into bands of equal width in octaves. Channel
+k of the V/Oct and gain inputs moves and scales band k, a mono cable acts on
+all bands. The bands come out one per channel, and summed on the mix output.
+*/
+struct FilterBank : Module {
+	enum ParamId {
+		LOW_PARAM,
+		HIGH_PARAM,
+		Q_PARAM,
+		PARAMS_LEN
+	};
+	enum InputId {
+		VPOCT_INPUT,
+		GAIN_INPUT,
+		SIGNAL_INPUT,
+		INPUTS_LEN
+	};
+	enum OutputId {
+		MIX_OUTPUT,
+		BANDS_OUTPUT,
+		OUTPUTS_LEN
+	};
+	enum LightId {
+		LIGHTS_LEN
+	};
+
+	static constexpr unsigned CONTROL_PERIOD = 16;
+
+	cs::FilterBank bank;
+	unsigned bands = 8;
+	unsigned control_phase = 0;
+
+	FilterBank() {
+		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
+		configParam(LOW_PARAM, std::log2(20.f), std::log2(2000.f), std::log2(100.f), "Lowest edge", "Hz", 2);
+		configParam(HIGH_PARAM, std::log2(200.f), std::log2(20000.f), std::log2(8000.f), "Highest edge", "Hz", 2);
+		configParam(Q_PARAM, std::log2(0.5f), std::log2(10.f), std::log2(0.707f), "Edge Q", "", 2);
+		configInput(VPOCT_INPUT, "Band V/Oct");
+		configInput(GAIN_INPUT, "Band gain");
+		configInput(SIGNAL_INPUT, "Signal");
+		configOutput(MIX_OUTPUT, "Mix");
+		configOutput(BANDS_OUTPUT, "Bands");
+		configBypass(SIGNAL_INPUT, MIX_OUTPUT);
+	}
+
+	void onSampleRateChange(const SampleRateChangeEvent& e) override
+	{
+		bank = cs::FilterBank(e.sampleRate);
+		control_phase = 0;
+	}
+
+	json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+		json_object_set_new(rootJ, "bands", json_integer(bands));
+		return rootJ;
+	}
+
+	void dataFromJson(json_t* rootJ) override {
+		json_t* bandsJ = json_object_get(rootJ, "bands");
+		unsigned count = json_integer_value(bandsJ);
+		if (count == 4 || count == 8 || count == 16) {
+			bands = count;
+		}
+	}
+
+	// Channels c to c+3 of a polyphonic input, a mono one acts on every band.
+	float_4 bandVoltages(Input& input, unsigned c, float normal)
+	{
+		if(!input.isConnected()){
+			return float_4(normal);
+		}
+		return input.getPolyVoltageSimd<float_4>(c);
+	}
+
+	// Band edges from the knobs and inputs, evaluated once per block.
+	void setBands(unsigned vectors)
+	{
+		float low = params[LOW_PARAM].getValue();
+		float high = std::max(params[HIGH_PARAM].getValue(), low);
+		float width = (high - low)/bands;
+		float_4 Q = float_4(dsp::approxExp2_taylor5(params[Q_PARAM].getValue()));
+
+		float_4 lower[cs::FilterBank::MAX_VECTORS];
+		float_4 upper[cs::FilterBank::MAX_VECTORS];
+		float_4 q[cs::FilterBank::MAX_VECTORS];
+		for(unsigned v = 0; v < vectors; v++){
+			float_4 band = float_4(0.f, 1.f, 2.f, 3.f) + float_4(4.f*v);
+			float_4 edge = float_4(low) + float_4(width)*band + bandVoltages(inputs[VPOCT_INPUT], 4*v, 0.f);
+			lower[v] = dsp::approxExp2_taylor5(edge);
+			upper[v] = dsp::approxExp2_taylor5(edge + float_4(width));
+			q[v] = Q;
+		}
+		bank.setBands(lower, upper, q, vectors, CONTROL_PERIOD);
+	}
+
+	void process(const ProcessArgs& args) override
+	{
+		unsigned vectors = bands/4;
+		if(control_phase == 0){
+			setBands(vectors);
+		}
+		control_phase = (control_phase + 1 >= CONTROL_PERIOD) ? 0 : control_phase + 1;
+
+		float_4 out[cs::FilterBank::MAX_VECTORS];
+		bank.process(inputs[SIGNAL_INPUT].getVoltageSum(), out, vectors);
+
+		float_4 mix = float_4::zero();
+		outputs[BANDS_OUTPUT].setChannels(bands);
+		for(unsigned v = 0; v < vectors; v++){
+			out[v] *= 0.1f*bandVoltages(inputs[GAIN_INPUT], 4*v, 10.f);
+			mix += out[v];
+			outputs[BANDS_OUTPUT].setVoltageSimd(out[v], 4*v);
+		}
+		outputs[MIX_OUTPUT].setVoltage(mix[0] + mix[1] + mix[2] + mix[3]);
+	}
+};
+
+
+struct FilterBankWidget : ModuleWidget {
+	FilterBankWidget(FilterBank* module) {
+		setModule(module);
+		setPanel(createPanel(asset::plugin(pluginInstance, "res/filter_bank.svg")));
+
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 17.78)), module, FilterBank::LOW_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 31.75)), module, FilterBank::HIGH_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 45.72)), module, FilterBank::Q_PARAM));
+
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(10.16, 60.96)), module, FilterBank::VPOCT_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(10.16, 72.39)), module, FilterBank::GAIN_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(10.16, 86.36)), module, FilterBank::SIGNAL_INPUT));
+
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 99.06)), module, FilterBank::MIX_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 110.49)), module, FilterBank::BANDS_OUTPUT));
+	}
+
+	void appendContextMenu(Menu* menu) override {
+		FilterBank* module = dynamic_cast<FilterBank*>(this->module);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Bands"));
+
+		struct BandsItem : MenuItem {
+			FilterBank* module;
+			unsigned bands;
+			void onAction(const event::Action& e) override {
+				module->bands = bands;
+				module->control_phase = 0;
+			}
+		};
+
+		unsigned counts[3] = {4, 8, 16};
+		for (unsigned count : counts) {
+			BandsItem* bands_item = createMenuItem<BandsItem>(string::f("%u", count));
+			bands_item->rightText = CHECKMARK(module->bands == count);
+			bands_item->module = module;
+			bands_item->bands = count;
+			menu->addChild(bands_item);
+		}
+	}
+};
+
+
+Model* modelFilterBank = createModel<FilterBank, FilterBankWidget>("FilterBank");
@@ -0,0 +1,179 @@
+#include "impulse_response.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+
+static uint32_t readLE(uint8_t const* p, unsigned bytes)
+{
+	uint32_t v = 0;
+	for(unsigned i = 0; i < bytes; i++){
+		v |= (uint32_t)p[i] << (8*i);
+	}
+	return v;
+}
+
+// One sample of the given format, full scale at 1.
+static float readSample(uint8_t const* p, unsigned format, unsigned bits)
+{
+	uint32_t v = readLE(p, bits/8);
+	if(format == 3){
+		float f;
+		std::memcpy(&f, &v, sizeof(f));
+		return f;
+	}
+	// Sign extend from the top bit of the sample.
+	int32_t s = (int32_t)(v << (32 - bits));
+	return s/2147483648.f;
+}
+
+std::shared_ptr<ImpulseResponse const> loadImpulseResponse(std::string const& path)
+{
+	std::vector<uint8_t> file;
+	std::FILE* f = std::fopen(path.c_str(), "rb");
+	if(f){
+		uint8_t buffer[4096];
+		size_t read;
+		while((read = std::fread(buffer, 1, sizeof(buffer), f)) > 0){
+			file.insert(file.end(), buffer, buffer + read);
+		}
+		std::fclose(f);
+	}
+	if(file.size() < 12 || std::memcmp(file.data(), "RIFF", 4) || std::memcmp(file.data() + 8, "WAVE", 4)){
+		WARN("Could not read %s as a WAV file", path.c_str());
+		return nullptr;
+	}
+
+	unsigned format = 0;
+	unsigned channels = 0;
+	unsigned rate = 0;
+	unsigned block_align = 0;
+	unsigned bits = 0;
+	uint8_t const* data = nullptr;
+	size_t data_size = 0;
+	for(size_t pos = 12; pos + 8 <= file.size();){
+		uint8_t const* chunk = file.data() + pos + 8;
+		size_t size = std::min((size_t)readLE(file.data() + pos + 4, 4), file.size() - pos - 8);
+		if(!std::memcmp(file.data() + pos, "fmt ", 4) && size >= 16){
+			format = readLE(chunk, 2);
+			channels = readLE(chunk + 2, 2);
+			rate = readLE(chunk + 4, 4);
+			block_align = readLE(chunk + 12, 2);
+			bits = readLE(chunk + 14, 2);
+			// WAVE_FORMAT_EXTENSIBLE, the format is the start of the sub format GUID.
+			if(format == 0xFFFE && size >= 26){
+				format = readLE(chunk + 24, 2);
+			}
+		}
+		else if(!std::memcmp(file.data() + pos, "data", 4)){
+			data = chunk;
+			data_size = size;
+		}
+		pos += 8 + size + (size & 1);
+	}
+
+	bool supported = (format == 1 && (bits == 16 || bits == 24 || bits == 32)) || (format == 3 && bits == 32);
+	if(!data || !supported || channels == 0 || rate == 0 || block_align < channels*bits/8){
+		WARN("Unsupported WAV format in %s", path.c_str());
+		return nullptr;
+	}
+
+	size_t frames = std::min(data_size/block_align, (size_t)(MAX_IMPULSE_LENGTH*rate));
+	std::shared_ptr<ImpulseResponse> impulse = std::make_shared<ImpulseResponse>();
+	impulse->FS = rate;
+	impulse->left.resize(frames);
+	if(channels > 1){
+		impulse->right.resize(frames);
+	}
+	for(size_t i = 0; i < frames; i++){
+		uint8_t const* frame = data + i*block_align;
+		impulse->left[i] = readSample(frame, format, bits);
+		if(channels > 1){
+			impulse->right[i] = readSample(frame + bits/8, format, bits);
+		}
+	}
+	return impulse;
+}
+
+ImpulseResponse earlyReflections(float FS)
+{
+	// Reflections between 5 and 80 ms, 30 dB quieter at the end. The generator
+	// is seeded, so every instance and rate gets the same pattern.
+	static constexpr unsigned REFLECTIONS = 32;
+	static constexpr float FIRST = 0.005f;
+	static constexpr float LAST = 0.08f;
+	std::minstd_rand random(1);
+	std::uniform_real_distribution<float> time(FIRST, LAST);
+
+	ImpulseResponse impulse;
+	impulse.FS = FS;
+	impulse.left.assign((size_t)(LAST*FS) + 1, 0.f);
+	impulse.right.assign((size_t)(LAST*FS) + 1, 0.f);
+	for(std::vector<float>* channel : {&impulse.left, &impulse.right}){
+		for(unsigned i = 0; i < REFLECTIONS; i++){
+			float t = time(random);
+			float gain = std::pow(10.f, -1.5f*(t - FIRST)/(LAST - FIRST));
+			float sign = (random() & 1) ? 1.f : -1.f;
+			(*channel)[(size_t)(t*FS)] += sign*gain;
+		}
+	}
+	return impulse;
+}
+
+/*
+Windowed-sinc resampling, Blackman window of HALF_WIDTH zero crossings on
+each side. Below the input rate the cutoff follows the output rate.
+*/
+static std::vector<float> resample(std::vector<float> const& in, float in_fs, float out_fs)
+{
+	static constexpr float HALF_WIDTH = 16.f;
+	if(in_fs == out_fs){
+		return in;
+	}
+	float ratio = out_fs/in_fs;
+	float cutoff = std::min(1.f, ratio);
+	float half_width = HALF_WIDTH/cutoff;
+	std::vector<float> out((size_t)std::ceil(in.size()*ratio));
+	for(size_t j = 0; j < out.size(); j++){
+		float center = j/ratio;
+		int first = std::max(0, (int)std::ceil(center - half_width));
+		int last = std::min((int)in.size() - 1, (int)std::floor(center + half_width));
+		float sum = 0.f;
+		for(int k = first; k <= last; k++){
+			float x = k - center;
+			float sinc = (x == 0.f) ? 1.f : std::sin(M_PI*cutoff*x)/(M_PI*cutoff*x);
+			float window = 0.42f + 0.5f*std::cos(M_PI*x/half_width) + 0.08f*std::cos(2.f*M_PI*x/half_width);
+			sum += in[k]*cutoff*sinc*window;
+		}
+		out[j] = sum;
+	}
+	return out;
+}
+
+static void normalize(std::vector<float>& v)
+{
+	float energy = 0.f;
+	for(float x : v){
+		energy += x*x;
+	}
+	if(energy > 0.f){
+		float gain = 1.f/std::sqrt(energy);
+		for(float& x : v){
+			x *= gain;
+		}
+	}
+}
+
+ImpulseResponse prepareImpulse(ImpulseResponse const& impulse, float FS)
+{
+	ImpulseResponse prepared;
+	prepared.FS = FS;
+	prepared.left = resample(impulse.left, impulse.FS, FS);
+	prepared.right = impulse.right.empty() ? prepared.left : resample(impulse.right, impulse.FS, FS);
+	normalize(prepared.left);
+	normalize(prepared.right);
+	return prepared;
+}
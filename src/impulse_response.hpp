@@ -0,0 +1,26 @@
+#pragma once
+#include "plugin.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Longest impulse response the Reverb convolves, in seconds.
+static constexpr float MAX_IMPULSE_LENGTH = 4.f;
+
+// Impulse response of the Reverb's convolution stage, mono impulses have an empty right channel.
+struct ImpulseResponse {
+	float FS = 48000.f;
+	std::vector<float> left;
+	std::vector<float> right;
+};
+
+// Reads a WAV file of 16, 24 or 32 bit PCM or 32 bit float samples. Keeps the
+// first two channels and MAX_IMPULSE_LENGTH seconds, nullptr if the file can't be read.
+std::shared_ptr<ImpulseResponse const> loadImpulseResponse(std::string const& path);
+
+// Sparse stereo early reflections, generated at FS.
+ImpulseResponse earlyReflections(float FS);
+
+// The impulse resampled to FS, both channels filled and scaled to unit energy.
+ImpulseResponse prepareImpulse(ImpulseResponse const& impulse, float FS);
@@ -0,0 +1,314 @@
+#include "plugin.hpp"
+#include "components/channel_bank.hpp"
+#include "components/grain_shifter.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+Granular pitch shifter, the one the Reverb's shimmer uses. The grains can be
+detuned against each other for a chorus-like spread, jitter keeps them from
+comb filtering each other, and 8 grains (context menu) overlap more smoothly
+than 4 at twice the cost. Up to 16 channels.
+*/
+struct PitchShifter : Module {
+	enum ParamId {
+		PITCH_PARAM,
+		SPREAD_PARAM,
+		JITTER_PARAM,
+		WINDOW_PARAM,
+		MIX_PARAM,
+		PARAMS_LEN
+	};
+	enum InputId {
+		VPOCT_INPUT,
+		SIGNAL_INPUT,
+		INPUTS_LEN
+	};
+	enum OutputId {
+		SIGNAL_OUTPUT,
+		OUTPUTS_LEN
+	};
+	enum LightId {
+		LIGHTS_LEN
+	};
+
+	// Longest grain window, in seconds.
+	static constexpr float MAX_WINDOW = 0.1f;
+	static constexpr unsigned CONTROL_PERIOD = 16;
+
+	/*
+	The shifters of all channels, for one grain count and sample rate: 16
+	lines of 32768 floats (2 MB) at 48 kHz, twice that per doubling of the
+	rate. Sets are built by the worker and handed to the audio thread, which
+	hands the one it replaces back to be freed, so the engine never
+	allocates. The first set is built once the module processes audio, with
+	the settings at that point, the output is the input until it is there.
+	*/
+	struct ShifterSet {
+		float FS;
+		bool eight_grains;
+		// One shifter per channel. The grains run per channel rather than per
+		// float_4 bank, so these are not cs::ChannelBanks.
+		std::vector<cs::GrainShifter<4>> shifters4;
+		std::vector<cs::GrainShifter<8>> shifters8;
+
+		ShifterSet(float FS, bool eight_grains)
+		: FS(FS),
+		  eight_grains(eight_grains)
+		{
+			if(eight_grains){
+				shifters8.reserve(cs::MAX_CHANNELS);
+			}
+			else{
+				shifters4.reserve(cs::MAX_CHANNELS);
+			}
+			for(unsigned c = 0; c < cs::MAX_CHANNELS; c++){
+				if(eight_grains){
+					shifters8.push_back(cs::GrainShifter<8>(FS, MAX_WINDOW, c + 1));
+				}
+				else{
+					shifters4.push_back(cs::GrainShifter<4>(FS, MAX_WINDOW, c + 1));
+				}
+			}
+		}
+	};
+
+	// Settings read by the worker.
+	std::atomic<float> FS{48000.f};
+	std::atomic<bool> eight_grains{false};
+
+	// Only the audio thread uses `shifters`. A set left in `prepared` replaces
+	// it at the next sample, and the replaced one goes to `retired`.
+	std::unique_ptr<ShifterSet> shifters;
+	std::atomic<ShifterSet*> prepared{nullptr};
+	std::atomic<ShifterSet*> retired{nullptr};
+	std::atomic<unsigned> request_sequence{0};
+	std::thread worker;
+	std::mutex worker_mutex;
+	std::condition_variable worker_cv;
+	std::atomic<bool> worker_running{true};
+	std::atomic<bool> started{false};
+	// A wakeup the audio thread could not deliver yet, see tryWakeWorker().
+	bool wake_pending = false;
+	unsigned control_phase = 0;
+
+	PitchShifter() {
+		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
+		configParam(PITCH_PARAM, -24.f, 24.f, 0.f, "Pitch", " semitones");
+		getParamQuantity(PITCH_PARAM)->snapEnabled = true;
+		configParam(SPREAD_PARAM, 0.f, 50.f, 0.f, "Grain detune spread", " cents");
+		configParam(JITTER_PARAM, 0.f, 1.f, 0.5f, "Grain jitter", "%", 0.f, 100.f);
+		configParam(WINDOW_PARAM, 0.01f, MAX_WINDOW, 0.05f, "Grain window", " ms", 0.f, 1000.f);
+		configParam(MIX_PARAM, 0.f, 1.f, 1.f, "Mix", "%", 0.f, 100.f);
+		configInput(VPOCT_INPUT, "V/Oct");
+		configInput(SIGNAL_INPUT, "Signal");
+		configOutput(SIGNAL_OUTPUT, "Signal");
+		configBypass(SIGNAL_INPUT, SIGNAL_OUTPUT);
+		worker = std::thread(&PitchShifter::workerLoop, this);
+		postRequest();
+	}
+
+	~PitchShifter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(worker_mutex);
+			worker_running = false;
+		}
+		worker_cv.notify_one();
+		worker.join();
+		delete prepared.load();
+		delete retired.load();
+	}
+
+	// Called after changing a setting, from any thread but the audio thread.
+	void postRequest(void)
+	{
+		request_sequence++;
+		{
+			std::lock_guard<std::mutex> lock(worker_mutex);
+		}
+		worker_cv.notify_one();
+	}
+
+	// The audio thread never waits for worker_mutex: while the worker holds
+	// it, the wakeup is tried again on the next sample.
+	void tryWakeWorker(void)
+	{
+		wake_pending = !worker_mutex.try_lock();
+		if(wake_pending){
+			return;
+		}
+		worker_mutex.unlock();
+		worker_cv.notify_one();
+	}
+
+	// Called with worker_mutex held. A new set is only built once the audio
+	// thread has taken the last one.
+	bool workPending(unsigned handled)
+	{
+		return !worker_running || retired.load() || (started && request_sequence != handled && !prepared.load());
+	}
+
+	void workerLoop(void)
+	{
+		unsigned handled = 0;
+		float built_fs = 0.f;
+		bool built_eight_grains = false;
+		while(true){
+			{
+				std::unique_lock<std::mutex> lock(worker_mutex);
+				worker_cv.wait(lock, [&]{ return workPending(handled); });
+				if(!worker_running){
+					return;
+				}
+			}
+			delete retired.exchange(nullptr);
+			unsigned posted = request_sequence;
+			if(posted == handled || prepared.load()){
+				continue;
+			}
+			handled = posted;
+			float fs = FS;
+			bool eight = eight_grains;
+			if(fs != built_fs || eight != built_eight_grains){
+				built_fs = fs;
+				built_eight_grains = eight;
+				prepared.store(new ShifterSet(fs, eight), std::memory_order_release);
+			}
+		}
+	}
+
+	void onSampleRateChange(const SampleRateChangeEvent& e) override
+	{
+		if(e.sampleRate == FS){
+			return;
+		}
+		FS = e.sampleRate;
+		postRequest();
+	}
+
+	json_t* dataToJson() override
+	{
+		json_t* root_j = json_object();
+		json_object_set_new(root_j, "eight_grains", json_boolean(eight_grains));
+		return root_j;
+	}
+
+	void dataFromJson(json_t* root_j) override
+	{
+		json_t* eight_grains_j = json_object_get(root_j, "eight_grains");
+		if(eight_grains_j){
+			eight_grains = json_boolean_value(eight_grains_j);
+			postRequest();
+		}
+	}
+
+	// The grains are detuned evenly over +-spread/2 around the channel's ratio.
+	template <unsigned GRAINS>
+	void setGrains(cs::GrainShifter<GRAINS>& shifter, float ratio, float spread, float jitter, float window)
+	{
+		simd::float_4 ratios[GRAINS/4];
+		for(unsigned v = 0; v < GRAINS/4; v++){
+			simd::float_4 grain = simd::float_4(0.f, 1.f, 2.f, 3.f) + simd::float_4(4.f*v);
+			simd::float_4 detune = spread*(grain/simd::float_4(GRAINS - 1) - simd::float_4(0.5f));
+			ratios[v] = simd::float_4(ratio)*dsp::approxExp2_taylor5(detune/simd::float_4(1200.f));
+		}
+		shifter.setRatios(ratios);
+		shifter.setJitter(jitter);
+		shifter.setWindow(window);
+	}
+
+	void process(const ProcessArgs& args) override {
+		unsigned num_channels = std::max<unsigned>(inputs[SIGNAL_INPUT].getChannels(), inputs[VPOCT_INPUT].getChannels());
+		num_channels = cs::clampChannels(num_channels);
+		outputs[SIGNAL_OUTPUT].setChannels(num_channels);
+
+		if(wake_pending || (!shifters && !started.exchange(true))){
+			tryWakeWorker();
+		}
+		ShifterSet* ready = prepared.load(std::memory_order_acquire);
+		if(ready && !retired.load(std::memory_order_acquire)){
+			prepared.store(nullptr, std::memory_order_relaxed);
+			retired.store(shifters.release(), std::memory_order_release);
+			shifters.reset(ready);
+			control_phase = 0;
+			tryWakeWorker();
+		}
+		if(!shifters){
+			for(unsigned c = 0; c < num_channels; c++){
+				outputs[SIGNAL_OUTPUT].setVoltage(inputs[SIGNAL_INPUT].getPolyVoltage(c), c);
+			}
+			return;
+		}
+		ShifterSet& set = *shifters;
+
+		if(control_phase == 0){
+			float spread = params[SPREAD_PARAM].getValue();
+			float jitter = params[JITTER_PARAM].getValue();
+			float window = params[WINDOW_PARAM].getValue()*set.FS;
+			for(unsigned c = 0; c < num_channels; c++){
+				float pitch = params[PITCH_PARAM].getValue()/12.f + inputs[VPOCT_INPUT].getPolyVoltage(c);
+				float ratio = dsp::approxExp2_taylor5(clamp(pitch, -2.f, 2.f));
+				if(set.eight_grains){
+					setGrains(set.shifters8[c], ratio, spread, jitter, window);
+				}
+				else{
+					setGrains(set.shifters4[c], ratio, spread, jitter, window);
+				}
+			}
+		}
+		control_phase = (control_phase + 1 >= CONTROL_PERIOD) ? 0 : control_phase + 1;
+
+		float mix = params[MIX_PARAM].getValue();
+		for(unsigned c = 0; c < num_channels; c++){
+			float in = inputs[SIGNAL_INPUT].getPolyVoltage(c);
+			float shifted = set.eight_grains ? set.shifters8[c].process(in) : set.shifters4[c].process(in);
+			outputs[SIGNAL_OUTPUT].setVoltage(in + mix*(shifted - in), c);
+		}
+	}
+};
+
+
+struct PitchShifterWidget : ModuleWidget {
+	PitchShifterWidget(PitchShifter* module) {
+		setModule(module);
+		setPanel(createPanel(asset::plugin(pluginInstance, "res/pitch_shifter.svg")));
+
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 17.78)), module, PitchShifter::PITCH_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 41.91)), module, PitchShifter::SPREAD_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 53.34)), module, PitchShifter::JITTER_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 64.77)), module, PitchShifter::WINDOW_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 76.2)), module, PitchShifter::MIX_PARAM));
+
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(10.16, 29.21)), module, PitchShifter::VPOCT_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(10.16, 92.71)), module, PitchShifter::SIGNAL_INPUT));
+
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(10.16, 107.95)), module, PitchShifter::SIGNAL_OUTPUT));
+	}
+
+	void appendContextMenu(Menu* menu) override {
+		PitchShifter* module = dynamic_cast<PitchShifter*>(this->module);
+
+		menu->addChild(new MenuEntry);
+
+		struct EightGrainsItem : MenuItem {
+			PitchShifter* module;
+			void onAction(const event::Action& e) override {
+				module->eight_grains = !module->eight_grains;
+				module->postRequest();
+			}
+		};
+
+		EightGrainsItem* eight_grains_item = createMenuItem<EightGrainsItem>("8 grains");
+		eight_grains_item->rightText = CHECKMARK(module->eight_grains);
+		eight_grains_item->module = module;
+		menu->addChild(eight_grains_item);
+	}
+};
+
+
+Model* modelPitchShifter = createModel<PitchShifter, PitchShifterWidget>("PitchShifter");
@@ -1,4 +1,5 @@
 #include "plugin.hpp"
+#include "reverb_models.hpp"
 
 
 Plugin* pluginInstance;
@@ -13,8 +14,15 @@ void init(Plugin* p) {
 	// Any other plugin initialization may go here.
 	// As an alternative, consider lazy-loading assets and lookup tables when your module is created to reduce startup times of Rack.
 	p->addModel(modelReverb);
+	p->addModel(modelReverbSend);
+	p->addModel(modelPitchShifter);
 	p->addModel(modelFilter);
+	p->addModel(modelFilterBank);
 	p->addModel(modelDispersion);
 	p->addModel(modelSawtooth);
 	p->addModel(modelSine);
+
+	// Shared by all Reverb instances, parsed in the background so that neither
+	// loading the plugin nor creating a Reverb waits for file I/O.
+	startReverbModels();
 }
@@ -9,7 +9,10 @@ extern Plugin* pluginInstance;
 
 // Declare each Model, defined in each module source file
 extern Model* modelReverb;
+extern Model* modelReverbSend;
+extern Model* modelPitchShifter;
 extern Model* modelFilter;
+extern Model* modelFilterBank;
 extern Model* modelDispersion;
 extern Model* modelSawtooth;
 extern Model* modelSine;
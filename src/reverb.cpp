@@ -1,11 +1,24 @@
 #include "plugin.hpp"
+#include "reverb_models.hpp"
+#include "impulse_response.hpp"
+#include "reverb_send.hpp"
 
-#include "components/diffusion_stage.hpp"
-#include "components/one_pole.hpp"
+#include "components/reverb_network.hpp"
+#include "components/partitioned_convolution.hpp"
+#include "components/polyphase.hpp"
+#include "components/linear_ramp.hpp"
 #include "components/matched_biquad.hpp"
-#include "components/matched_shelving.hpp"
 #include "components/transient_detection.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <osdialog.h>
+
 struct Reverb : Module {
 	enum ParamId {
 		SIZE_PARAM,
@@ -20,6 +33,8 @@ struct Reverb : Module {
 		PREDELAY_PARAM,
 		DRY_PARAM,
 		WET_PARAM,
+		SHIMMER_PARAM,
+		SHIMMER_PITCH_PARAM,
 		PARAMS_LEN
 	};
 	enum InputId {
@@ -45,41 +60,200 @@ struct Reverb : Module {
 		LIGHTS_LEN
 	};
 
-	struct ReverbParameters{
-		simd::float_4 lengths[5] = {};
-		simd::float_4 normals[5] = {
-			simd::float_4(1, 1, 1, 1),
-			simd::float_4(1, 1, 1, 1),
-			simd::float_4(1, 1, 1, 1),
-			simd::float_4(1, 1, 1, 1),
-			simd::float_4(1, 1, 1, 1)
-		};
-	} rev_params;
-
-	float FS = 48000.0;
-	cs::DelayStage4 predelay;
-	cs::DiffusionStage diffusion1;
-	cs::DiffusionStage diffusion2;
-	cs::DiffusionStage diffusion3;
-	cs::DiffusionStage diffusion4;
-	cs::DiffusionStage delay;
-	cs::OnePole<simd::float_4> hp_filter;
-	cs::TwoShelves<simd::float_4> two_shelves;
+	// Delay memory is reserved for the largest model at this rate up front,
+	// so that model and sample rate changes up to it only reslice the arena.
+	static constexpr float MAX_ARENA_FS = 96000.f;
+	// Old and new tails are crossfaded over this time when the network is swapped.
+	static constexpr float SWAP_FADE_TIME = 0.1f;
+	// Below this level (in volts) inputs and tail count as silent.
+	static constexpr float SILENCE_LEVEL = 1e-5f;
+	// Predelay at the end of the knob, in seconds.
+	static constexpr float SHORT_PREDELAY = 0.25f;
+	// Rate the network runs at with fixed_rate, up to an integer ratio of the host rate.
+	static constexpr float INTERNAL_FS = 48000.f;
+	// Samples, at the network's rate, exchanged with the tail thread at once.
+	static constexpr unsigned TAIL_BLOCK = 128;
+	// Silent blocks queued ahead of the tail thread's first output. Rack
+	// renders a whole engine block (256 samples by default) in one burst,
+	// the tail thread needs that much head start to keep up without waits.
+	static constexpr unsigned TAIL_PREFILL = 2;
+	static constexpr unsigned MAX_INSTANCES = cs::ReverbNetwork::MAX_INSTANCES;
+
+	std::atomic<float> FS{48000.f};
 	cs::TransientDetector duck;
 
-	unsigned model_index = 0;
-	simd::float_4 back_fed = simd::float_4::zero();
+	/*
+	Model and sample rate changes bump `command_sequence`. The worker thread
+	then reads the settings, builds the requested network in the standby slot
+	and marks it ready, the audio thread crossfades to it and hands the old
+	slot back. The worker sleeps until a post, a swap that finished or a
+	reload of the models gives it something to do.
+
+	Nothing is built before the module first processes audio: by then the
+	sample rate, the patch data and the options are all known, so loading a
+	patch builds each network once instead of once per setup step. Until the
+	first network is ready only the dry signal is output.
+	*/
+	enum SwapState {
+		SWAP_IDLE,
+		SWAP_READY,
+		SWAP_FADING
+	};
+	enum Convolution {
+		CONVOLUTION_OFF,
+		CONVOLUTION_EARLY,
+		CONVOLUTION_USER
+	};
+	struct NetworkCommand {
+		unsigned model;
+		float FS;
+		unsigned ratio;
+		bool compressed;
+		unsigned convolution;
+		std::shared_ptr<ImpulseResponse const> impulse;
+		bool async;
+		unsigned instances;
+	};
+	/*
+	With async_tail the network of a slot runs on the tail thread. The audio
+	thread collects a block of inputs, hands it over and takes the output of
+	the block handed over TAIL_PREFILL blocks before, which the silent blocks
+	queued up front stand in for at first. The tail comes out
+	(TAIL_PREFILL + 1)*TAIL_BLOCK samples late and the predelay is shortened
+	by that much. The audio thread never waits: if that output is not there
+	yet the slot plays a silent block, and the output is dropped once it
+	arrives late. Blocks are numbered to tell which is which.
+	*/
+	struct TailBlock {
+		unsigned sequence;
+		simd::float_4 in[TAIL_BLOCK][MAX_INSTANCES];
+		unsigned count[TAIL_BLOCK];
+		float feedback[TAIL_BLOCK];
+		float predelay_time;
+		float diffusion_depth;
+		float delay_scale;
+		float low_shelf_gain;
+		float high_shelf_gain;
+		float shimmer_amount;
+		float shimmer_ratio;
+	};
+	struct TailOutput {
+		unsigned sequence;
+		simd::float_4 out[TAIL_BLOCK][MAX_INSTANCES];
+	};
+	/*
+	A network with the resampling around it. With a ratio above one the
+	network runs at FS/ratio: every ratio-th host sample the decimated input
+	is processed, and the interpolator spreads the result over the next
+	ratio host samples. The convolution stage runs at the network's rate,
+	in parallel to it. Everything is kept per instance. Instances that the
+	inputs stop using are skipped and marked stale, the worker silences them
+	and only then does the audio thread use them again.
+	*/
+	struct NetworkSlot {
+		std::unique_ptr<cs::ReverbNetwork> network;
+		// Model list the network was built from, a reload of the models publishes a new one.
+		std::shared_ptr<ReverbModels const> models;
+		unsigned model = 0;
+		float FS = 0.f;
+		unsigned ratio = 1;
+		bool compressed = false;
+		unsigned convolution = CONVOLUTION_OFF;
+		std::shared_ptr<ImpulseResponse const> impulse;
+		unsigned instances = 1;
+		// Instances in use on the audio thread, and on the network's thread.
+		unsigned active_instances = 1;
+		unsigned tail_instances = 1;
+		// Set by the audio thread for the instances it stops using, reset by
+		// the worker once it has silenced them.
+		std::atomic<bool> stale[MAX_INSTANCES] = {};
+		cs::PartitionedConvolver convolvers[MAX_INSTANCES][2];
+		// Samples, at the network's rate, until an input has left network and convolution.
+		size_t memory_length = 0;
+		bool async = false;
+		unsigned tail_phase = 0;
+		unsigned tail_sequence = 0;
+		TailBlock tail_in;
+		TailOutput tail_out;
+		// An output taken from from_tail before its turn, its own block was lost.
+		TailOutput tail_next;
+		bool tail_held = false;
+		dsp::RingBuffer<TailBlock, 4> to_tail;
+		dsp::RingBuffer<TailOutput, 4> from_tail;
+		// Whether the tail thread renders the slot. Only changed by the worker,
+		// under tail_mutex, which the tail thread holds while rendering.
+		bool tail_enabled = false;
+		unsigned phase = 0;
+		cs::PolyphaseDecimator4 decimator[MAX_INSTANCES];
+		cs::PolyphaseInterpolator4 interpolator[MAX_INSTANCES];
+		simd::float_4 block[MAX_INSTANCES][cs::PolyphaseFilter::MAX_RATIO];
+		// Control block the network parameters were last set from.
+		unsigned control_block = 0;
+	};
+	NetworkSlot slots[2];
+	std::atomic<int> active_network{0};
+	std::atomic<int> swap_state{SWAP_IDLE};
+	float swap_phase = 0.f;
+
+	std::atomic<unsigned> command_sequence{0};
+	std::thread worker;
+	std::mutex worker_mutex;
+	std::condition_variable worker_cv;
+	std::atomic<bool> worker_running{true};
+	std::atomic<bool> started{false};
+	// A wakeup the audio thread could not deliver yet, see tryWakeWorker().
+	bool wake_pending = false;
+	// Only runs while a slot is async, the worker starts and stops it.
+	std::thread tail_worker;
+	std::mutex tail_mutex;
+	std::condition_variable tail_cv;
+	std::atomic<bool> tail_running{false};
+
+	// Settings read by the worker are atomic, the UI thread changes them.
+	std::atomic<unsigned> model_index{0};
+	std::atomic<bool> fixed_rate{false};
+	// Stores the diffusion and feedback lines as 16 bit samples.
+	std::atomic<bool> compressed_tail{false};
+	// Extends the predelay knob to the full length of the network's predelay.
+	bool long_predelay = false;
+	// Renders the network on the tail thread.
+	std::atomic<bool> async_tail{false};
+	// Every channel of the inputs gets its own instance of the network.
+	std::atomic<bool> polyphonic{false};
+	std::atomic<unsigned> convolution{CONVOLUTION_OFF};
+	// The loaded impulse is shared with the commands, use std::atomic_load/store.
+	std::string impulse_path;
+	std::shared_ptr<ImpulseResponse const> impulse;
+
+	/*
+	Parameters are evaluated once every control_period samples. Feedback, wet
+	and dry are then ramped linearly over the period, the shelving filters
+	ramp their coefficients. Delay scales need no ramp, the grains of the
+	delay stages only pick them up at their own crossfades. The ducking
+	detector runs at the control rate on the peak of the block.
+	*/
+	unsigned control_period = 16;
+	unsigned control_phase = 0;
+	unsigned control_block = 0;
+	unsigned duck_period = 1;
+	float duck_peak = 0.f;
+	cs::LinearRamp<float> feedback_ramp;
+	cs::LinearRamp<float> wet_ramp;
+	cs::LinearRamp<float> dry_ramp;
+
+	/*
+	Once inputs and tail have stayed silent for as long as it takes a signal
+	to pass through every line of the network, the network is no longer
+	processed and only the dry signal is output. Any input wakes it up.
+	*/
+	bool sleeping = false;
+	size_t silent_samples = 0;
+
+	// Filled by a chain of ReverbSend modules on the left.
+	ReverbSendMessage send_messages[2];
 
 	Reverb() 
-	: predelay(cs::DelayStage4(simd::float_4(0.25f), FS)),
-	  diffusion1(cs::DiffusionStage(rev_params.lengths[0], rev_params.normals[0], FS)),
-	  diffusion2(cs::DiffusionStage(rev_params.lengths[1], rev_params.normals[1], FS)),
-	  diffusion3(cs::DiffusionStage(rev_params.lengths[2], rev_params.normals[2], FS)),
-	  diffusion4(cs::DiffusionStage(rev_params.lengths[3], rev_params.normals[3], FS)),
-	  delay(cs::DiffusionStage(rev_params.lengths[4], rev_params.normals[4], FS)),
-	  hp_filter(cs::OnePole<simd::float_4>(FS)),
-	  two_shelves(cs::TwoShelves<simd::float_4>(FS)),
-	  duck(cs::TransientDetector(FS))
+	: duck(cs::TransientDetector(FS))
 	{
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
 		configParam(SIZE_PARAM, 0.f, 1.f, 0.5f, "Size");
@@ -100,13 +274,32 @@ struct Reverb : Module {
 		configParam(FEEDBACK_MOD_PARAM, -1.f, 1.f, 0.f, "Feedback modulation depth");
 		configInput(FEEDBACK_MOD_INPUT, "Feedback modulation");
 		configParam(DUCKING_PARAM, 0.f, 1.f, 0.f, "Ducking");
+		configParam(SHIMMER_PARAM, 0.f, 1.f, 0.f, "Shimmer", "%", 0.f, 100.f);
+		configParam(SHIMMER_PITCH_PARAM, -12.f, 24.f, 12.f, "Shimmer pitch", " semitones");
+		getParamQuantity(SHIMMER_PITCH_PARAM)->snapEnabled = true;
 		configInput(LEFT_INPUT, "Left");
 		configInput(RIGHT_INPUT, "Right");
 		configOutput(LEFT_OUTPUT, "Left");
 		configOutput(RIGHT_OUTPUT, "Right");
 
-		model_index = loadModel(model_index);
-		hp_filter.setFrequency(10.f);
+		leftExpander.producerMessage = &send_messages[0];
+		leftExpander.consumerMessage = &send_messages[1];
+
+		showModel(model_index);
+		addReverbModelsListener(this, [this]{ wakeWorker(); });
+		worker = std::thread(&Reverb::workerLoop, this);
+	}
+
+	~Reverb()
+	{
+		removeReverbModelsListener(this);
+		{
+			std::lock_guard<std::mutex> lock(worker_mutex);
+			worker_running = false;
+		}
+		worker_cv.notify_one();
+		worker.join();
+		stopTail();
 	}
 
 	struct ProcessorParameters{
@@ -120,11 +313,14 @@ struct Reverb : Module {
 		float dry;
 		float wet;
 		float ducking_depth;
+		float shimmer_amount;
+		float shimmer_ratio;
 	} p;
 
-	void calculateProcessorParameters(simd::float_4 const in_signal)
+	void calculateProcessorParameters(float duck_signal)
 	{
-		p.predelay_time = dsp::cubic(params[PREDELAY_PARAM].getValue());
+		float predelay_range = long_predelay ? cs::ReverbNetwork::PREDELAY_LENGTH : SHORT_PREDELAY;
+		p.predelay_time = predelay_range*dsp::cubic(params[PREDELAY_PARAM].getValue());
 
 		p.diffusion_depth = params[DIFF_PARAM].getValue() + dsp::cubic(params[DIFF_MOD_PARAM].getValue()*inputs[DIFF_MOD_INPUT].getVoltage()*0.1f);
 		p.diffusion_depth = clamp(p.diffusion_depth, 0.f, 0.5f);
@@ -148,15 +344,16 @@ struct Reverb : Module {
 			p.low_shelf_gain = 1.f - tone*tone;
 		}
 
-		p.dry = params[DRY_PARAM].getValue();
-		p.dry += inputs[DRY_MOD_INPUT].getVoltage() * 0.1;
-		p.dry = clamp(p.dry);
+		p.dry = dryLevel();
 		p.wet = params[WET_PARAM].getValue();
 		p.wet += inputs[WET_MOD_INPUT].getVoltage() * 0.1;
 		p.wet = clamp(p.wet);
 
+		p.shimmer_amount = params[SHIMMER_PARAM].getValue();
+		p.shimmer_ratio = std::exp2(params[SHIMMER_PITCH_PARAM].getValue()/12.f);
+
 		float ducking_scale = (dsp::quintic(params[DUCKING_PARAM].getValue()));
-		p.ducking_depth = duck.process(ducking_scale*(in_signal[0] + in_signal[1]));
+		p.ducking_depth = duck.process(ducking_scale*duck_signal);
 
 		float feedback_param = params[FEEDBACK_PARAM].getValue();
 		if(feedback_param == 0.f){
@@ -172,99 +369,668 @@ struct Reverb : Module {
 		}
 	}
 
+	float dryLevel(void)
+	{
+		float dry = params[DRY_PARAM].getValue();
+		dry += inputs[DRY_MOD_INPUT].getVoltage() * 0.1;
+		return clamp(dry);
+	}
+
 	void process(const ProcessArgs& args) override
 	{
-		float left = inputs[LEFT_INPUT].getVoltageSum();
-		float right = inputs[RIGHT_INPUT].isConnected() ? inputs[RIGHT_INPUT].getVoltageSum() : left;
-		simd::float_4 v = simd::float_4(left, right, left, right);
+		unsigned count = 1;
+		float left[MAX_INSTANCES];
+		float right[MAX_INSTANCES];
+		if(polyphonic){
+			count = std::max(inputs[LEFT_INPUT].getChannels(), inputs[RIGHT_INPUT].getChannels());
+			count = clamp((int)count, 1, (int)MAX_INSTANCES);
+			for(unsigned k = 0; k < count; k++){
+				left[k] = inputs[LEFT_INPUT].getPolyVoltage(k);
+				right[k] = inputs[RIGHT_INPUT].isConnected() ? inputs[RIGHT_INPUT].getPolyVoltage(k) : left[k];
+			}
+		}
+		else{
+			left[0] = inputs[LEFT_INPUT].getVoltageSum();
+			right[0] = inputs[RIGHT_INPUT].isConnected() ? inputs[RIGHT_INPUT].getVoltageSum() : left[0];
+		}
+		simd::float_4 in[MAX_INSTANCES];
+		float out_left[MAX_INSTANCES];
+		float out_right[MAX_INSTANCES];
+		if(wake_pending){
+			tryWakeWorker();
+		}
+		int active = active_network.load(std::memory_order_relaxed);
+		if(!slots[active].network){
+			// There is no tail to fade from, the first network is switched to directly.
+			if(!started.exchange(true)){
+				tryWakeWorker();
+			}
+			if(swap_state.load(std::memory_order_acquire) != SWAP_READY){
+				float dry = dryLevel();
+				for(unsigned k = 0; k < count; k++){
+					out_left[k] = dry*left[k];
+					out_right[k] = dry*right[k];
+				}
+				setOutputs(out_left, out_right, count);
+				return;
+			}
+			active = 1 - active;
+			showModel(slots[active].model);
+			active_network.store(active, std::memory_order_relaxed);
+			swap_state.store(SWAP_IDLE, std::memory_order_release);
+			tryWakeWorker();
+		}
 
-		calculateProcessorParameters(v);
+		bool silent_input = true;
+		float peak = 0.f;
+		for(unsigned k = 0; k < count; k++){
+			in[k] = simd::float_4(left[k], right[k], left[k], right[k]);
+			silent_input = silent_input && std::fabs(left[k]) < SILENCE_LEVEL && std::fabs(right[k]) < SILENCE_LEVEL;
+			peak = std::max(peak, std::fabs(left[k] + right[k]));
+		}
+		// Sends only feed the first instance, they are not part of the dry signal.
+		ReverbSendMessage const* send = sendChain(this);
+		if(send){
+			in[0] += simd::float_4(send->left, send->right, send->left, send->right);
+			silent_input = silent_input && std::fabs(send->left) < SILENCE_LEVEL && std::fabs(send->right) < SILENCE_LEVEL;
+			peak = std::max(peak, std::fabs(send->left + send->right));
+		}
 
-		predelay.setScale(p.predelay_time);
-		diffusion1.setScale(p.diffusion_depth);
-		diffusion2.setScale(p.diffusion_depth);
-		diffusion3.setScale(p.diffusion_depth);
-		diffusion4.setScale(p.diffusion_depth);
-		delay.setScale(p.delay_scale);
-		two_shelves.setParams(p.shelving_center, p.low_shelf_gain, p.high_shelf_gain);
+		if(sleeping){
+			// A pending network swap has to finish before sleeping again.
+			if(silent_input && swap_state.load(std::memory_order_relaxed) == SWAP_IDLE){
+				float dry = dryLevel();
+				lights[DUCKING_LIGHT].setBrightnessSmooth(0.f, args.sampleTime);
+				for(unsigned k = 0; k < count; k++){
+					out_left[k] = dry*left[k];
+					out_right[k] = dry*right[k];
+				}
+				setOutputs(out_left, out_right, count);
+				return;
+			}
+			sleeping = false;
+			silent_samples = 0;
+			control_phase = 0;
+		}
+
+		duck_peak = std::max(duck_peak, peak);
+		if(control_phase == 0){
+			if(duck_period != control_period){
+				duck_period = control_period;
+				duck = cs::TransientDetector(FS.load()/duck_period);
+			}
+			calculateProcessorParameters(duck_peak);
+			duck_peak = 0.f;
+			feedback_ramp.setTarget(p.feedback, control_period);
+			wet_ramp.setTarget(p.wet, control_period);
+			dry_ramp.setTarget(p.dry, control_period);
+			control_block++;
+		}
+		control_phase = (control_phase + 1 >= control_period) ? 0 : control_phase + 1;
+		float feedback = feedback_ramp.process();
+		float wet = wet_ramp.process();
+		float dry = dry_ramp.process();
 
 		lights[DUCKING_LIGHT].setBrightnessSmooth(p.ducking_depth, args.sampleTime);
 
-		v = predelay.process(v);
-		v = v + back_fed;
-		v = v - hp_filter.process(v);
-		v = two_shelves.process(v);
-		v = diffusion1.process(v);
-		v = diffusion2.process(v);
-		v = diffusion3.process(v);
-		v = diffusion4.process(v);
-		left = p.wet*v[0] + p.dry*left;
-		right = p.wet*v[1] + p.dry*right;
-		v = delay.process(v);
-		back_fed = v * simd::float_4(p.feedback);
+		int state = swap_state.load(std::memory_order_acquire);
+		if(state == SWAP_READY){
+			swap_phase = 0.f;
+			state = SWAP_FADING;
+			swap_state.store(state, std::memory_order_relaxed);
+		}
 
+		simd::float_4 v[MAX_INSTANCES];
+		processSlot(slots[active], in, v, count, feedback);
+		if(state == SWAP_FADING){
+			int standby = 1 - active;
+			simd::float_4 w[MAX_INSTANCES];
+			processSlot(slots[standby], in, w, count, feedback);
+			swap_phase += args.sampleTime / SWAP_FADE_TIME;
+			if(swap_phase >= 1.f){
+				std::copy(w, w + count, v);
+				showModel(slots[standby].model);
+				active_network.store(standby, std::memory_order_relaxed);
+				swap_state.store(SWAP_IDLE, std::memory_order_release);
+				tryWakeWorker();
+			}
+			else{
+				// Equal power, the two tails are uncorrelated.
+				float angle = 0.5f*M_PI*swap_phase;
+				for(unsigned k = 0; k < count; k++){
+					v[k] = std::cos(angle)*v[k] + std::sin(angle)*w[k];
+				}
+			}
+		}
+
+		bool silent_tail = true;
+		for(unsigned k = 0; k < count; k++){
+			silent_tail = silent_tail && simd::movemask(simd::fabs(v[k]) >= simd::float_4(SILENCE_LEVEL)) == 0;
+		}
+		if(silent_input && silent_tail){
+			silent_samples++;
+			NetworkSlot& slot = slots[active_network.load(std::memory_order_relaxed)];
+			sleeping = silent_samples > slot.ratio*slot.memory_length + cs::PolyphaseFilter::MAX_TAPS;
+		}
+		else{
+			silent_samples = 0;
+		}
+
+		for(unsigned k = 0; k < count; k++){
+			out_left[k] = wet*v[k][0] + dry*left[k];
+			out_right[k] = wet*v[k][1] + dry*right[k];
+		}
+		setOutputs(out_left, out_right, count);
+	}
+
+	// One channel per instance on each output, or the pairs interleaved on
+	// the left output if the right one is not connected.
+	void setOutputs(float const* left, float const* right, unsigned count)
+	{
 		if(outputs[RIGHT_OUTPUT].isConnected()){
-			outputs[LEFT_OUTPUT].setChannels(1);
-			outputs[LEFT_OUTPUT].setVoltage(left);
-			outputs[RIGHT_OUTPUT].setVoltage(right);
+			outputs[LEFT_OUTPUT].setChannels(count);
+			outputs[RIGHT_OUTPUT].setChannels(count);
+			for(unsigned k = 0; k < count; k++){
+				outputs[LEFT_OUTPUT].setVoltage(left[k], k);
+				outputs[RIGHT_OUTPUT].setVoltage(right[k], k);
+			}
+		}
+		else{
+			outputs[LEFT_OUTPUT].setChannels(2*count);
+			for(unsigned k = 0; k < count; k++){
+				outputs[LEFT_OUTPUT].setVoltage(left[k], 2*k);
+				outputs[LEFT_OUTPUT].setVoltage(right[k], 2*k + 1);
+			}
+		}
+	}
+
+	// Instances the inputs stop using are left to the worker to silence, the
+	// ones they use again are taken up in order once it has. Until then they
+	// stay silent, clearing them here would be megabytes of writes.
+	void activateInstances(NetworkSlot& slot, unsigned count)
+	{
+		for(unsigned k = count; k < slot.active_instances; k++){
+			slot.stale[k].store(true, std::memory_order_release);
+		}
+		unsigned active = std::min(count, slot.active_instances);
+		if(active < slot.active_instances){
+			tryWakeWorker();
+		}
+		while(active < count && !slot.stale[active].load(std::memory_order_acquire)){
+			active++;
+		}
+		slot.active_instances = active;
+	}
+
+	// Called from the worker. With async slots the tail thread silences the
+	// network itself when an instance comes back.
+	void clearInstances(NetworkSlot& slot)
+	{
+		for(unsigned k = 0; k < MAX_INSTANCES; k++){
+			if(!slot.stale[k].load(std::memory_order_acquire)){
+				continue;
+			}
+			slot.convolvers[k][0].reset();
+			slot.convolvers[k][1].reset();
+			slot.decimator[k].setRatio(slot.ratio);
+			slot.interpolator[k].setRatio(slot.ratio);
+			std::fill(slot.block[k], slot.block[k] + cs::PolyphaseFilter::MAX_RATIO, simd::float_4::zero());
+			if(!slot.async){
+				slot.network->clear(k);
+			}
+			slot.stale[k].store(false, std::memory_order_release);
+		}
+	}
+
+	bool hasStaleInstances(NetworkSlot const& slot)
+	{
+		for(unsigned k = 0; k < MAX_INSTANCES; k++){
+			if(slot.stale[k].load(std::memory_order_relaxed)){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void processNetwork(NetworkSlot& slot, simd::float_4 const* in, simd::float_4* out, unsigned count, float feedback)
+	{
+		if(slot.async){
+			exchangeTail(slot, in, out, count, feedback);
 		}
 		else{
-			outputs[LEFT_OUTPUT].setChannels(2);
-			outputs[LEFT_OUTPUT].setVoltage(left, 0);
-			outputs[LEFT_OUTPUT].setVoltage(right, 1);
+			cs::ReverbNetwork& network = *slot.network;
+			if(slot.control_block != control_block){
+				slot.control_block = control_block;
+				network.setScales(p.predelay_time, p.diffusion_depth, p.delay_scale);
+				unsigned ramp = control_period/slot.ratio;
+				network.setShelves(p.shelving_center, p.low_shelf_gain, p.high_shelf_gain, ramp);
+				network.setShimmer(p.shimmer_amount, p.shimmer_ratio);
+			}
+			network.process(in, out, count, feedback);
+		}
+		if(slot.convolution != CONVOLUTION_OFF){
+			for(unsigned k = 0; k < count; k++){
+				float left = slot.convolvers[k][0].process(in[k][0]);
+				float right = slot.convolvers[k][1].process(in[k][1]);
+				out[k] += simd::float_4(left, right, left, right);
+			}
+		}
+	}
+
+	// Tail latency of async slots, in seconds.
+	float tailLatency(NetworkSlot const& slot)
+	{
+		return (TAIL_PREFILL + 1.f)*TAIL_BLOCK*slot.ratio/slot.FS;
+	}
+
+	void exchangeTail(NetworkSlot& slot, simd::float_4 const* in, simd::float_4* out, unsigned count, float feedback)
+	{
+		unsigned i = slot.tail_phase;
+		std::copy(in, in + count, slot.tail_in.in[i]);
+		std::copy(slot.tail_out.out[i], slot.tail_out.out[i] + count, out);
+		slot.tail_in.count[i] = count;
+		slot.tail_in.feedback[i] = feedback;
+		slot.tail_phase++;
+		if(slot.tail_phase == TAIL_BLOCK){
+			slot.tail_phase = 0;
+			TailBlock& block = slot.tail_in;
+			block.predelay_time = std::max(0.f, p.predelay_time - tailLatency(slot));
+			block.diffusion_depth = p.diffusion_depth;
+			block.delay_scale = p.delay_scale;
+			block.low_shelf_gain = p.low_shelf_gain;
+			block.high_shelf_gain = p.high_shelf_gain;
+			block.shimmer_amount = p.shimmer_amount;
+			block.shimmer_ratio = p.shimmer_ratio;
+			block.sequence = slot.tail_sequence++;
+			// A tail thread this far behind loses the block.
+			if(!slot.to_tail.full()){
+				slot.to_tail.push(block);
+			}
+			tail_cv.notify_one();
+			takeTail(slot, block.sequence - TAIL_PREFILL);
+		}
+	}
+
+	// Moves the output of block `sequence` to tail_out, or silence if it is not there.
+	void takeTail(NetworkSlot& slot, unsigned sequence)
+	{
+		while(slot.tail_held || !slot.from_tail.empty()){
+			if(!slot.tail_held){
+				slot.tail_next = slot.from_tail.shift();
+				slot.tail_held = true;
+			}
+			int age = (int)(sequence - slot.tail_next.sequence);
+			if(age < 0){
+				break;
+			}
+			slot.tail_held = false;
+			if(age == 0){
+				slot.tail_out = slot.tail_next;
+				return;
+			}
+		}
+		slot.tail_out = TailOutput();
+	}
+
+	void renderTail(NetworkSlot& slot, TailBlock const& block)
+	{
+		cs::ReverbNetwork& network = *slot.network;
+		network.setScales(block.predelay_time, block.diffusion_depth, block.delay_scale);
+		network.setShelves(p.shelving_center, block.low_shelf_gain, block.high_shelf_gain, TAIL_BLOCK);
+		network.setShimmer(block.shimmer_amount, block.shimmer_ratio);
+		TailOutput output;
+		output.sequence = block.sequence;
+		for(unsigned i = 0; i < TAIL_BLOCK; i++){
+			unsigned count = block.count[i];
+			for(unsigned k = slot.tail_instances; k < count; k++){
+				network.clear(k);
+			}
+			slot.tail_instances = count;
+			network.process(block.in[i], output.out[i], count, block.feedback[i]);
+			// A block rendered with fewer instances can be played with more.
+			std::fill(output.out[i] + count, output.out[i] + MAX_INSTANCES, simd::float_4::zero());
+		}
+		slot.from_tail.push(output);
+	}
+
+	bool tailPending(void)
+	{
+		for(NetworkSlot const& slot : slots){
+			if(slot.tail_enabled && !slot.to_tail.empty()){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void tailLoop(void)
+	{
+		std::unique_lock<std::mutex> lock(tail_mutex);
+		while(tail_running){
+			bool rendered = false;
+			for(NetworkSlot& slot : slots){
+				if(slot.tail_enabled && !slot.to_tail.empty()){
+					renderTail(slot, slot.to_tail.shift());
+					rendered = true;
+				}
+			}
+			// The audio thread does not lock, so a wakeup can be missed. The
+			// timeout bounds that well within the TAIL_PREFILL blocks of head start.
+			if(!rendered){
+				tail_cv.wait_for(lock, std::chrono::milliseconds(1), [this]{ return !tail_running || tailPending(); });
+			}
+		}
+	}
+
+	// Called from the worker, and from the destructor once the worker is gone.
+	void startTail(void)
+	{
+		if(!tail_running){
+			tail_running = true;
+			tail_worker = std::thread(&Reverb::tailLoop, this);
+		}
+	}
+
+	// Waits for a block of the slot being rendered, the tail thread then leaves it alone.
+	void setTailEnabled(NetworkSlot& slot, bool enabled)
+	{
+		std::lock_guard<std::mutex> lock(tail_mutex);
+		slot.tail_enabled = enabled;
+	}
+
+	void stopTail(void)
+	{
+		if(tail_running){
+			{
+				std::lock_guard<std::mutex> lock(tail_mutex);
+				tail_running = false;
+			}
+			tail_cv.notify_one();
+			tail_worker.join();
+		}
+	}
+
+	void processSlot(NetworkSlot& slot, simd::float_4 const* in, simd::float_4* out, unsigned count, float feedback)
+	{
+		unsigned used = std::min(count, slot.instances);
+		if(used != slot.active_instances){
+			activateInstances(slot, used);
+		}
+		// Instances the slot lacks or has not got back yet are silent.
+		used = slot.active_instances;
+		std::fill(out + used, out + count, simd::float_4::zero());
+		count = used;
+		if(slot.ratio == 1){
+			processNetwork(slot, in, out, count, feedback);
+			return;
+		}
+		for(unsigned k = 0; k < count; k++){
+			slot.decimator[k].push(in[k]);
+		}
+		if(slot.phase == 0){
+			simd::float_4 decimated[MAX_INSTANCES];
+			simd::float_4 v[MAX_INSTANCES];
+			for(unsigned k = 0; k < count; k++){
+				decimated[k] = slot.decimator[k].process();
+			}
+			processNetwork(slot, decimated, v, count, feedback);
+			for(unsigned k = 0; k < count; k++){
+				slot.interpolator[k].process(v[k], slot.block[k]);
+			}
 		}
+		for(unsigned k = 0; k < count; k++){
+			out[k] = slot.block[k][slot.phase];
+		}
+		slot.phase = (slot.phase + 1 == slot.ratio) ? 0 : slot.phase + 1;
 	}
 
 	void onSampleRateChange(const SampleRateChangeEvent& e) override
 	{
 		FS = e.sampleRate;
-		reloadProcessors();
+		duck = cs::TransientDetector(e.sampleRate/duck_period);
+		postCommand();
 	}
 
 	void loadNextModel(void)
 	{
-		model_index = loadModel(++model_index);
-	}
-
-	unsigned loadReverbParameters(ReverbParameters& params, unsigned model_index);
-	unsigned loadModel(unsigned index)
-	{
-		unsigned ret = loadReverbParameters(rev_params, model_index);
-		reloadProcessors();
-		lights[MODEL1_LIGHT].setBrightness(0);
-		lights[MODEL2_LIGHT].setBrightness(0);
-		switch(ret){
-		case 0:
-			lights[MODEL1_LIGHT].setBrightness(1);
-			break;
-		case 1:
-			lights[MODEL2_LIGHT].setBrightness(1);
-			break;
-		default:
-			break;
-		};
-		return ret;
+		size_t models_length = reverbModels()->size();
+		model_index = models_length ? (model_index + 1) % models_length : 0;
+		postCommand();
+	}
+
+	void loadModel(unsigned index)
+	{
+		model_index = index;
+		postCommand();
+	}
+
+	// The two lights show the model number (index + 1) in binary.
+	void showModel(unsigned index)
+	{
+		lights[MODEL1_LIGHT].setBrightness((index + 1) & 1);
+		lights[MODEL2_LIGHT].setBrightness(((index + 1) >> 1) & 1);
+	}
+
+	// Called from the worker.
+	NetworkCommand makeCommand(void)
+	{
+		float fs = FS;
+		unsigned ratio = 1;
+		if(fixed_rate){
+			ratio = std::max(1, (int)std::round(fs/INTERNAL_FS));
+			ratio = std::min(ratio, (unsigned)cs::PolyphaseFilter::MAX_RATIO);
+		}
+		std::shared_ptr<ImpulseResponse const> user_impulse = std::atomic_load(&impulse);
+		// Without a loaded impulse the user convolution stays off.
+		unsigned mode = convolution;
+		if(mode == CONVOLUTION_USER && !user_impulse){
+			mode = CONVOLUTION_OFF;
+		}
+		unsigned instances = polyphonic ? (unsigned)MAX_INSTANCES : 1;
+		return NetworkCommand{model_index, fs, ratio, compressed_tail, mode, mode == CONVOLUTION_USER ? user_impulse : nullptr, async_tail, instances};
+	}
+
+	// Called after changing a setting, from any thread but the audio thread.
+	void postCommand(void)
+	{
+		command_sequence++;
+		wakeWorker();
+	}
+
+	// The worker checks for work under worker_mutex, taking it once after the
+	// change makes sure the wakeup is not lost. Not for the audio thread.
+	void wakeWorker(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(worker_mutex);
+		}
+		worker_cv.notify_one();
+	}
+
+	// wakeWorker() for the audio thread, which never waits for worker_mutex:
+	// while the worker holds it, the wakeup is tried again on the next sample.
+	void tryWakeWorker(void)
+	{
+		wake_pending = !worker_mutex.try_lock();
+		if(wake_pending){
+			return;
+		}
+		worker_mutex.unlock();
+		worker_cv.notify_one();
+	}
+
+	// Called from the UI thread, an unreadable file keeps the current impulse.
+	void loadImpulse(std::string const& path)
+	{
+		std::shared_ptr<ImpulseResponse const> loaded = loadImpulseResponse(path);
+		if(!loaded){
+			return;
+		}
+		std::atomic_store(&impulse, loaded);
+		impulse_path = path;
+		convolution = CONVOLUTION_USER;
+		postCommand();
+	}
+
+	// Arena rows taken by the delay lines of the largest model of a channel count at the given rate.
+	size_t arenaRows(ReverbModels const& models, unsigned channels, bool compressed, float fs)
+	{
+		size_t rows = 0;
+		for(ReverbModel const& model : models){
+			if(model.channels == channels){
+				rows = std::max(rows, cs::ReverbNetwork::arenaRows(channels, compressed, model.lengths.data(), fs));
+			}
+		}
+		return rows;
+	}
+
+	void prepareNetwork(int index, NetworkCommand command)
+	{
+		NetworkSlot& slot = slots[index];
+		ReverbModel model;
+		std::shared_ptr<ReverbModels const> models = reverbModels();
+		if(!models->empty()){
+			command.model %= models->size();
+			model = (*models)[command.model];
+		}
+		float network_fs = command.FS/command.ratio;
+		// Networks are only replaced here, while the audio thread does not use the slot.
+		if(!slot.network || slot.network->getChannels() != model.channels || slot.network->isCompressed() != command.compressed
+			|| slot.network->getInstances() != command.instances){
+			slot.network.reset(cs::createReverbNetwork(model.channels, command.compressed, command.instances, network_fs));
+		}
+		float reserve_fs = network_fs > MAX_ARENA_FS ? network_fs : MAX_ARENA_FS;
+		size_t reserve_rows = command.instances*arenaRows(*models, model.channels, command.compressed, reserve_fs);
+		slot.network->configure(model.lengths.data(), model.normals.data(), model.mixers, network_fs, reserve_rows);
+
+		if(command.convolution != slot.convolution || command.impulse != slot.impulse || command.FS/command.ratio != slot.FS/slot.ratio
+			|| command.instances != slot.instances){
+			ImpulseResponse kernel;
+			if(command.convolution == CONVOLUTION_EARLY){
+				kernel = prepareImpulse(earlyReflections(network_fs), network_fs);
+			}
+			else if(command.convolution == CONVOLUTION_USER){
+				kernel = prepareImpulse(*command.impulse, network_fs);
+			}
+			for(unsigned k = 0; k < MAX_INSTANCES; k++){
+				bool used = k < command.instances;
+				slot.convolvers[k][0].setImpulse(kernel.left.data(), used ? kernel.left.size() : 0);
+				slot.convolvers[k][1].setImpulse(kernel.right.data(), used ? kernel.right.size() : 0);
+			}
+		}
+		else{
+			for(unsigned k = 0; k < MAX_INSTANCES; k++){
+				slot.convolvers[k][0].reset();
+				slot.convolvers[k][1].reset();
+			}
+		}
+		slot.convolution = command.convolution;
+		slot.impulse = command.impulse;
+		slot.instances = command.instances;
+		slot.active_instances = command.instances;
+		slot.tail_instances = command.instances;
+		for(unsigned k = 0; k < MAX_INSTANCES; k++){
+			slot.stale[k].store(false, std::memory_order_relaxed);
+		}
+		slot.memory_length = std::max(slot.network->getMemoryLength(), slot.convolvers[0][0].getLength());
+
+		slot.async = command.async;
+		slot.tail_phase = 0;
+		slot.tail_in = TailBlock();
+		slot.tail_out = TailOutput();
+		slot.tail_held = false;
+		slot.to_tail.clear();
+		slot.from_tail.clear();
+		// Stand-ins for the outputs of the blocks before the first one.
+		for(unsigned b = 0; b < TAIL_PREFILL; b++){
+			TailOutput silence = TailOutput();
+			silence.sequence = b;
+			slot.from_tail.push(silence);
+		}
+		slot.tail_sequence = TAIL_PREFILL;
+		if(slot.async){
+			slot.memory_length += (TAIL_PREFILL + 1)*TAIL_BLOCK;
+		}
+		slot.models = models;
+		slot.model = command.model;
+		slot.FS = command.FS;
+		slot.ratio = command.ratio;
+		slot.compressed = command.compressed;
+		slot.phase = 0;
+		for(unsigned k = 0; k < MAX_INSTANCES; k++){
+			slot.decimator[k].setRatio(command.ratio);
+			slot.interpolator[k].setRatio(command.ratio);
+		}
+	}
+
+	// Called with worker_mutex held. The standby slot is only the worker's while no swap is in flight.
+	bool workPending(unsigned handled)
+	{
+		if(!worker_running){
+			return true;
+		}
+		if(!started || swap_state.load(std::memory_order_acquire) != SWAP_IDLE){
+			return false;
+		}
+		int active = active_network.load(std::memory_order_relaxed);
+		NetworkSlot const& slot = slots[active];
+		return !slot.network || command_sequence != handled || slots[1 - active].tail_enabled
+			|| (tail_running && !slot.async) || hasStaleInstances(slot) || reverbModels() != slot.models;
 	}
 
-	void reloadProcessors(void)
+	void workerLoop(void)
 	{
-		back_fed = simd::float_4::zero();
-		predelay = cs::DelayStage4(simd::float_4(0.25f), FS);
-		diffusion1 = cs::DiffusionStage(rev_params.lengths[0], rev_params.normals[0], FS);
-		diffusion2 = cs::DiffusionStage(rev_params.lengths[1], rev_params.normals[1], FS);
-		diffusion3 = cs::DiffusionStage(rev_params.lengths[2], rev_params.normals[2], FS);
-		diffusion4 = cs::DiffusionStage(rev_params.lengths[3], rev_params.normals[3], FS);
-	  	delay = cs::DiffusionStage(rev_params.lengths[4], rev_params.normals[4], FS);
-		hp_filter = cs::OnePole<simd::float_4>(FS);
-		hp_filter.setFrequency(10.f);
-		two_shelves = cs::TwoShelves<simd::float_4>(FS);
-		duck = cs::TransientDetector(FS);
+		unsigned handled = 0;
+		while(true){
+			{
+				std::unique_lock<std::mutex> lock(worker_mutex);
+				worker_cv.wait(lock, [&]{ return workPending(handled); });
+				if(!worker_running){
+					return;
+				}
+			}
+			int active = active_network.load(std::memory_order_relaxed);
+			NetworkSlot& slot = slots[active];
+			if(slot.network){
+				clearInstances(slot);
+			}
+			// The standby slot is not played, the tail thread is only needed for an async active one.
+			setTailEnabled(slots[1 - active], false);
+			if(!slot.async){
+				stopTail();
+			}
+			unsigned posted = command_sequence;
+			bool pending = posted != handled;
+			handled = posted;
+			// The settings of the first network are the ones at the first process call,
+			// a reload of the models rebuilds the network with the current ones.
+			NetworkCommand command = makeCommand();
+			bool reload = slot.network && reverbModels() != slot.models;
+			if(!slot.network || reload || (pending && (command.model != slot.model || command.FS != slot.FS || command.ratio != slot.ratio || command.compressed != slot.compressed
+				|| command.convolution != slot.convolution || command.impulse != slot.impulse || command.async != slot.async
+				|| command.instances != slot.instances))){
+				prepareNetwork(1 - active, command);
+				if(slots[1 - active].async){
+					startTail();
+					setTailEnabled(slots[1 - active], true);
+				}
+				swap_state.store(SWAP_READY, std::memory_order_release);
+			}
+		}
 	}
 
 	json_t* dataToJson() override
 	{
 		json_t* root = json_object();
 		json_object_set_new(root, "model", json_integer(model_index));
+		json_object_set_new(root, "fixed_rate", json_boolean(fixed_rate));
+		json_object_set_new(root, "control_period", json_integer(control_period));
+		json_object_set_new(root, "long_predelay", json_boolean(long_predelay));
+		json_object_set_new(root, "compressed_tail", json_boolean(compressed_tail));
+		json_object_set_new(root, "async_tail", json_boolean(async_tail));
+		json_object_set_new(root, "polyphonic", json_boolean(polyphonic));
+		json_object_set_new(root, "convolution", json_integer(convolution));
+		json_object_set_new(root, "impulse_path", json_string(impulse_path.c_str()));
 		return root;
 	}
 
@@ -273,11 +1039,51 @@ struct Reverb : Module {
 		json_t* model_json = json_object_get(root, "model");
 		if(model_json){
 			model_index = json_integer_value(model_json);
-			model_index = loadModel(model_index);
 		}
+		json_t* control_period_json = json_object_get(root, "control_period");
+		if(control_period_json){
+			control_period = clamp((int)json_integer_value(control_period_json), 1, 32);
+		}
+		json_t* long_predelay_json = json_object_get(root, "long_predelay");
+		if(long_predelay_json){
+			long_predelay = json_boolean_value(long_predelay_json);
+		}
+		json_t* compressed_tail_json = json_object_get(root, "compressed_tail");
+		if(compressed_tail_json){
+			compressed_tail = json_boolean_value(compressed_tail_json);
+		}
+		json_t* polyphonic_json = json_object_get(root, "polyphonic");
+		if(polyphonic_json){
+			polyphonic = json_boolean_value(polyphonic_json);
+		}
+		json_t* async_tail_json = json_object_get(root, "async_tail");
+		if(async_tail_json){
+			async_tail = json_boolean_value(async_tail_json);
+		}
+		json_t* convolution_json = json_object_get(root, "convolution");
+		if(convolution_json){
+			convolution = clamp((int)json_integer_value(convolution_json), (int)CONVOLUTION_OFF, (int)CONVOLUTION_USER);
+		}
+		json_t* impulse_path_json = json_object_get(root, "impulse_path");
+		if(impulse_path_json){
+			impulse_path = json_string_value(impulse_path_json);
+			std::atomic_store(&impulse, impulse_path.empty() ? nullptr : loadImpulseResponse(impulse_path));
+		}
+		json_t* fixed_rate_json = json_object_get(root, "fixed_rate");
+		if(fixed_rate_json){
+			fixed_rate = json_boolean_value(fixed_rate_json);
+		}
+		postCommand();
 	}
 };
 
+// Called from the thread that processes the module.
+bool reverbNetworkReady(Module* module)
+{
+	Reverb* reverb = dynamic_cast<Reverb*>(module);
+	return reverb && reverb->slots[reverb->active_network.load(std::memory_order_relaxed)].network;
+}
+
 struct DiffModeButton : VCVButton{
 	void onDragStart(const DragStartEvent& e) override
 	{
@@ -320,51 +1126,184 @@ struct ReverbWidget : ModuleWidget {
 		addChild(createLightCentered<MediumLight<WhiteLight>>(mm2px(Vec(60.863, 44.59)), module, Reverb::MODEL2_LIGHT));
 		addChild(createLightCentered<MediumLight<WhiteLight>>(mm2px(Vec(25.395, 64.779)), module, Reverb::DUCKING_LIGHT));
 	}
+
+	void appendContextMenu(Menu* menu) override {
+		Reverb* module = dynamic_cast<Reverb*>(this->module);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Model"));
+
+		struct ModelItem : MenuItem {
+			Reverb* module;
+			unsigned index;
+			void onAction(const event::Action& e) override {
+				module->loadModel(index);
+			}
+		};
+
+		std::shared_ptr<ReverbModels const> models = reverbModels();
+		for(unsigned i = 0; i < models->size(); i++){
+			ReverbModel const& model = (*models)[i];
+			ModelItem* model_item = createMenuItem<ModelItem>(string::f("%s (%u channels)", model.name.c_str(), model.channels));
+			model_item->rightText = CHECKMARK(module->model_index == i);
+			model_item->module = module;
+			model_item->index = i;
+			menu->addChild(model_item);
+		}
+		menu->addChild(createMenuLabel("User models: " + reverbModelDirectory()));
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Shimmer"));
+
+		ui::Slider* shimmer_slider = new ui::Slider;
+		shimmer_slider->quantity = module->getParamQuantity(Reverb::SHIMMER_PARAM);
+		shimmer_slider->box.size.x = 200.f;
+		menu->addChild(shimmer_slider);
+
+		ui::Slider* shimmer_pitch_slider = new ui::Slider;
+		shimmer_pitch_slider->quantity = module->getParamQuantity(Reverb::SHIMMER_PITCH_PARAM);
+		shimmer_pitch_slider->box.size.x = 200.f;
+		menu->addChild(shimmer_pitch_slider);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Channels"));
+
+		struct PolyphonicItem : MenuItem {
+			Reverb* module;
+			void onAction(const event::Action& e) override {
+				module->polyphonic = !module->polyphonic;
+				module->postCommand();
+			}
+		};
+
+		PolyphonicItem* polyphonic_item = createMenuItem<PolyphonicItem>(string::f("One reverb per channel, up to %u", Reverb::MAX_INSTANCES));
+		polyphonic_item->rightText = CHECKMARK(module->polyphonic);
+		polyphonic_item->module = module;
+		menu->addChild(polyphonic_item);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Predelay"));
+
+		struct LongPredelayItem : MenuItem {
+			Reverb* module;
+			void onAction(const event::Action& e) override {
+				module->long_predelay ^= true;
+			}
+		};
+
+		LongPredelayItem* long_predelay_item = createMenuItem<LongPredelayItem>(string::f("Up to %g s", cs::ReverbNetwork::PREDELAY_LENGTH));
+		long_predelay_item->rightText = CHECKMARK(module->long_predelay);
+		long_predelay_item->module = module;
+		menu->addChild(long_predelay_item);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Processing rate"));
+
+		struct FixedRateItem : MenuItem {
+			Reverb* module;
+			void onAction(const event::Action& e) override {
+				module->fixed_rate = !module->fixed_rate;
+				module->postCommand();
+			}
+		};
+
+		FixedRateItem* fixed_rate_item = createMenuItem<FixedRateItem>(string::f("Tail at %g kHz", Reverb::INTERNAL_FS/1000.f));
+		fixed_rate_item->rightText = CHECKMARK(module->fixed_rate);
+		fixed_rate_item->module = module;
+		menu->addChild(fixed_rate_item);
+
+		struct AsyncTailItem : MenuItem {
+			Reverb* module;
+			void onAction(const event::Action& e) override {
+				module->async_tail = !module->async_tail;
+				module->postCommand();
+			}
+		};
+
+		Reverb::NetworkSlot const& active_slot = module->slots[module->active_network.load()];
+		AsyncTailItem* async_tail_item = createMenuItem<AsyncTailItem>(string::f("Tail on its own thread (%.1f ms late)", 1000.f*module->tailLatency(active_slot)));
+		async_tail_item->rightText = CHECKMARK(module->async_tail);
+		async_tail_item->module = module;
+		menu->addChild(async_tail_item);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Tail memory"));
+
+		struct CompressedTailItem : MenuItem {
+			Reverb* module;
+			void onAction(const event::Action& e) override {
+				module->compressed_tail = !module->compressed_tail;
+				module->postCommand();
+			}
+		};
+
+		CompressedTailItem* compressed_tail_item = createMenuItem<CompressedTailItem>("16 bit samples");
+		compressed_tail_item->rightText = CHECKMARK(module->compressed_tail);
+		compressed_tail_item->module = module;
+		menu->addChild(compressed_tail_item);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Convolution"));
+
+		struct ConvolutionItem : MenuItem {
+			Reverb* module;
+			unsigned convolution;
+			void onAction(const event::Action& e) override {
+				module->convolution = convolution;
+				module->postCommand();
+			}
+		};
+
+		struct LoadImpulseItem : MenuItem {
+			Reverb* module;
+			void onAction(const event::Action& e) override {
+				std::string dir = module->impulse_path.empty() ? asset::user("") : system::getDirectory(module->impulse_path);
+				osdialog_filters* filters = osdialog_filters_parse("WAV:wav");
+				char* path = osdialog_file(OSDIALOG_OPEN, dir.c_str(), NULL, filters);
+				osdialog_filters_free(filters);
+				if(path){
+					module->loadImpulse(path);
+					std::free(path);
+				}
+			}
+		};
+
+		std::string impulse_name = module->impulse_path.empty() ? "none loaded" : system::getFilename(module->impulse_path);
+		std::string convolution_names[3] = {"Off", "Early reflections", "Impulse response (" + impulse_name + ")"};
+		for (unsigned mode = Reverb::CONVOLUTION_OFF; mode <= Reverb::CONVOLUTION_USER; mode++) {
+			ConvolutionItem* convolution_item = createMenuItem<ConvolutionItem>(convolution_names[mode]);
+			convolution_item->rightText = CHECKMARK(module->convolution == mode);
+			convolution_item->module = module;
+			convolution_item->convolution = mode;
+			convolution_item->disabled = mode == Reverb::CONVOLUTION_USER && !std::atomic_load(&module->impulse);
+			menu->addChild(convolution_item);
+		}
+
+		LoadImpulseItem* load_impulse_item = createMenuItem<LoadImpulseItem>("Load impulse response...");
+		load_impulse_item->module = module;
+		menu->addChild(load_impulse_item);
+
+		menu->addChild(new MenuEntry);
+		menu->addChild(createMenuLabel("Control rate"));
+
+		struct ControlPeriodItem : MenuItem {
+			Reverb* module;
+			unsigned period;
+			void onAction(const event::Action& e) override {
+				module->control_period = period;
+			}
+		};
+
+		unsigned periods[3] = {1, 16, 32};
+		for (unsigned period : periods) {
+			ControlPeriodItem* period_item = createMenuItem<ControlPeriodItem>(period == 1 ? "Every sample" : string::f("Every %u samples", period));
+			period_item->rightText = CHECKMARK(module->control_period == period);
+			period_item->module = module;
+			period_item->period = period;
+			menu->addChild(period_item);
+		}
+	}
 };
 
 
 Model* modelReverb = createModel<Reverb, ReverbWidget>("Reverb");
-
-unsigned Reverb::loadReverbParameters(ReverbParameters& params, unsigned model_index)
-{
-	std::string params_filename = asset::plugin(pluginInstance, "src/reverb_constants.json");
-	
-	FILE* file = fopen(params_filename.c_str(), "r");
-	json_error_t err;
-	json_t* file_j = json_loadf(file, 0, &err);
-	size_t models_length = json_array_size(file_j);
-	if(models_length){
-		model_index %= models_length;
-		json_t* model_j = json_array_get(file_j, model_index);
-
-		json_t* lengths_j = json_object_get(model_j, "lengths");
-		for(int i = 0; i < 5; i++){
-			json_t* lengths_i_j = json_array_get(lengths_j, i);
-			params.lengths[i] = simd::float_4(
-			json_real_value(json_array_get(lengths_i_j, 0)), 
-			json_real_value(json_array_get(lengths_i_j, 1)), 
-			json_real_value(json_array_get(lengths_i_j, 2)), 
-			json_real_value(json_array_get(lengths_i_j, 3)));
-			json_decref(lengths_i_j);
-		}
-		json_decref(lengths_j);
-
-		json_t* normals_j = json_object_get(model_j, "mixer_normals");
-		for(int i = 0; i < 5; i++){
-			json_t* normals_i_j = json_array_get(normals_j, i);
-			params.normals[i] = simd::float_4(
-			json_real_value(json_array_get(normals_i_j, 0)), 
-			json_real_value(json_array_get(normals_i_j, 1)), 
-			json_real_value(json_array_get(normals_i_j, 2)), 
-			json_real_value(json_array_get(normals_i_j, 3)));
-			json_decref(normals_i_j);
-		}
-		json_decref(normals_j);
-		json_decref(lengths_j);
-		json_decref(model_j);
-		json_decref(file_j);
-		return model_index;
-	}
-	json_decref(file_j);
-	return 0;
-}
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include "reverb_models.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+
+// Reads an array of `count` numbers into count/4 vectors, false if the size is wrong or a number is not finite.
+static bool parseLanes(json_t* array_j, unsigned count, simd::float_4* out)
+{
+	if(json_array_size(array_j) != count){
+		return false;
+	}
+	for(unsigned i = 0; i < count; i++){
+		json_t* number_j = json_array_get(array_j, i);
+		float x = json_number_value(number_j);
+		if(!json_is_number(number_j) || !std::isfinite(x)){
+			return false;
+		}
+		out[i/4][i%4] = x;
+	}
+	return true;
+}
+
+// Parses and validates one model, false (with a warning) if it is unusable.
+static bool parseReverbModel(json_t* model_j, std::string const& name, ReverbModel& model)
+{
+	json_t* lengths_j = json_object_get(model_j, "lengths");
+	json_t* normals_j = json_object_get(model_j, "mixer_normals");
+	json_t* mixers_j = json_object_get(model_j, "mixers");
+
+	json_t* channels_j = json_object_get(model_j, "channels");
+	unsigned channels = channels_j ? json_integer_value(channels_j) : 4;
+	if(channels != 4 && channels != 8 && channels != 16){
+		WARN("Reverb model %s: unsupported channel count %u", name.c_str(), channels);
+		return false;
+	}
+
+	model = ReverbModel(channels);
+	model.name = name;
+	unsigned groups = channels/4;
+	for(unsigned i = 0; i < 5; i++){
+		if(!parseLanes(json_array_get(lengths_j, i), channels, &model.lengths[i*groups])
+			|| !parseLanes(json_array_get(normals_j, i), channels, &model.normals[i*groups])){
+			WARN("Reverb model %s: stage %u needs %u finite lengths and mixer normals", name.c_str(), i, channels);
+			return false;
+		}
+		for(unsigned g = 0; g < groups; g++){
+			simd::float_4 length = model.lengths[i*groups + g];
+			if(simd::movemask((length < simd::float_4::zero()) | (length > simd::float_4(MAX_MODEL_LENGTH)))){
+				WARN("Reverb model %s: stage %u has lengths outside 0 to %g s", name.c_str(), i, MAX_MODEL_LENGTH);
+				return false;
+			}
+		}
+		if(mixers_j){
+			char const* mixer = json_string_value(json_array_get(mixers_j, i));
+			std::string type = mixer ? mixer : "";
+			if(type == "hadamard"){
+				model.mixers[i] = cs::MIXER_HADAMARD;
+			}
+			else if(type != "householder"){
+				WARN("Reverb model %s: stage %u has an unknown mixer", name.c_str(), i);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Appends the valid models of one file, an array of model objects.
+static void parseReverbModels(std::string const& filename, std::string const& prefix, ReverbModels& models)
+{
+	json_error_t err;
+	json_t* file_j = json_load_file(filename.c_str(), 0, &err);
+	if(!file_j){
+		WARN("Could not parse %s: %s (line %d)", filename.c_str(), err.text, err.line);
+		return;
+	}
+
+	// All references below are borrowed from file_j.
+	for(size_t m = 0; m < json_array_size(file_j); m++){
+		ReverbModel model;
+		if(parseReverbModel(json_array_get(file_j, m), string::f("%s %d", prefix.c_str(), (int)m + 1), model)){
+			models.push_back(model);
+		}
+	}
+
+	json_decref(file_j);
+}
+
+/*
+Owns the published model list and the thread that keeps it up to date. The
+thread parses the bundled file and the user directory, then polls the
+directory once a second. When the names, sizes or modification times of its
+JSON files change, everything is parsed again into a new list, which
+replaces the old one with an atomic pointer swap. Readers keep the list
+they got for as long as they hold it. Listeners are told about each new
+list, so nothing has to poll for it.
+*/
+struct ReverbModelLibrary {
+	std::shared_ptr<ReverbModels const> models;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool running = true;
+	std::mutex listeners_mutex;
+	std::map<void const*, std::function<void(void)>> listeners;
+
+	ReverbModelLibrary()
+	{
+		thread = std::thread(&ReverbModelLibrary::watch, this);
+	}
+
+	~ReverbModelLibrary()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		cv.notify_all();
+		thread.join();
+	}
+
+	// JSON files of the user directory, sorted, with their size and modification time.
+	static std::string scan(std::vector<std::string>& files)
+	{
+		std::string signature;
+		files.clear();
+		std::vector<std::string> entries;
+		std::string directory = reverbModelDirectory();
+		if(system::isDirectory(directory)){
+			// Entries may vanish while the directory is being edited.
+			try{
+				entries = system::getEntries(directory);
+			}
+			catch(std::exception& e){
+				WARN("Could not list %s: %s", directory.c_str(), e.what());
+			}
+		}
+		for(std::string const& path : entries){
+			struct stat info;
+			if(system::getExtension(path) != ".json" || stat(path.c_str(), &info) || !S_ISREG(info.st_mode)){
+				continue;
+			}
+			files.push_back(path);
+		}
+		std::sort(files.begin(), files.end());
+		for(std::string const& path : files){
+			struct stat info;
+			stat(path.c_str(), &info);
+			signature += string::f("%s %lld %lld\n", path.c_str(), (long long)info.st_size, (long long)info.st_mtime);
+		}
+		return signature;
+	}
+
+	void watch(void)
+	{
+		std::string signature;
+		bool first = true;
+		std::unique_lock<std::mutex> lock(mutex);
+		while(running){
+			std::vector<std::string> files;
+			std::string current = scan(files);
+			if(first || current != signature){
+				lock.unlock();
+				std::shared_ptr<ReverbModels> parsed = std::make_shared<ReverbModels>();
+				parseReverbModels(asset::plugin(pluginInstance, "src/reverb_constants.json"), "Model", *parsed);
+				for(std::string const& path : files){
+					parseReverbModels(path, system::getStem(path), *parsed);
+				}
+				if(!first){
+					INFO("Reloaded Reverb models, %d in total", (int)parsed->size());
+				}
+				lock.lock();
+				std::atomic_store(&models, std::shared_ptr<ReverbModels const>(parsed));
+				signature = current;
+				first = false;
+				cv.notify_all();
+				lock.unlock();
+				{
+					std::lock_guard<std::mutex> listeners_lock(listeners_mutex);
+					for(std::pair<void const* const, std::function<void(void)>>& listener : listeners){
+						listener.second();
+					}
+				}
+				lock.lock();
+			}
+			cv.wait_for(lock, std::chrono::seconds(1));
+		}
+	}
+
+	std::shared_ptr<ReverbModels const> get(void)
+	{
+		std::shared_ptr<ReverbModels const> list = std::atomic_load(&models);
+		if(!list){
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this]{ return std::atomic_load(&models) != nullptr; });
+			list = std::atomic_load(&models);
+		}
+		return list;
+	}
+};
+
+static ReverbModelLibrary& library(void)
+{
+	static ReverbModelLibrary l;
+	return l;
+}
+
+std::string reverbModelDirectory(void)
+{
+	// The plugin's slug may not be set yet while init() runs.
+	return asset::user("chipselect/reverb_models");
+}
+
+void startReverbModels(void)
+{
+	library();
+}
+
+std::shared_ptr<ReverbModels const> reverbModels(void)
+{
+	return library().get();
+}
+
+void addReverbModelsListener(void const* owner, std::function<void(void)> listener)
+{
+	ReverbModelLibrary& l = library();
+	std::lock_guard<std::mutex> lock(l.listeners_mutex);
+	l.listeners[owner] = listener;
+}
+
+void removeReverbModelsListener(void const* owner)
+{
+	ReverbModelLibrary& l = library();
+	std::lock_guard<std::mutex> lock(l.listeners_mutex);
+	l.listeners.erase(owner);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "plugin.hpp"
+#include "components/matrix_mixer.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Longest delay of a model stage, in seconds at full size.
+static constexpr float MAX_MODEL_LENGTH = 1.f;
+
+// Delay lengths (in seconds) and mixer normals of the five diffusion stages of one Reverb model.
+// Each stage has channels/4 vectors, stored one stage after the other.
+struct ReverbModel {
+	// Source file (or "Model" for the bundled ones) and position in it.
+	std::string name;
+	unsigned channels;
+	std::vector<simd::float_4> lengths;
+	std::vector<simd::float_4> normals;
+	cs::MixerType mixers[5] = {
+		cs::MIXER_HOUSEHOLDER,
+		cs::MIXER_HOUSEHOLDER,
+		cs::MIXER_HOUSEHOLDER,
+		cs::MIXER_HOUSEHOLDER,
+		cs::MIXER_HOUSEHOLDER
+	};
+
+	ReverbModel(unsigned channels = 4)
+	: channels(channels),
+	  lengths(5*channels/4, simd::float_4::zero()),
+	  normals(5*channels/4, simd::float_4(1.f)) {}
+};
+
+typedef std::vector<ReverbModel> ReverbModels;
+
+// User models are read from the JSON files of this directory, in the format of src/reverb_constants.json.
+std::string reverbModelDirectory(void);
+
+// Starts the thread that parses the models and reloads them when the user directory changes.
+void startReverbModels(void);
+
+// The models of src/reverb_constants.json followed by the valid user models.
+// Waits for the first parse, later calls return the latest list. A list is
+// immutable and stays valid for as long as it is held.
+std::shared_ptr<ReverbModels const> reverbModels(void);
+
+// Calls `listener` on the watching thread after every reload until it is
+// removed. Removing waits for a call in progress, so the listener may use
+// its owner up to then.
+void addReverbModelsListener(void const* owner, std::function<void(void)> listener);
+void removeReverbModelsListener(void const* owner);
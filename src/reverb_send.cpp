@@ -0,0 +1,129 @@
+#include "plugin.hpp"
+#include "reverb_send.hpp"
+
+#include "components/delay_arena.hpp"
+#include "components/diffusion_stage.hpp"
+#include "components/matched_shelving.hpp"
+
+/*
+Feeds a Reverb placed to its right, directly or through more sends, so that
+several sources share one delay network. Each send has its own level,
+predelay and tone, applied before it is added to the chain. Every send in
+the chain adds a sample of latency, the expander messages move one module
+per sample.
+*/
+struct ReverbSend : Module {
+	enum ParamId {
+		LEVEL_PARAM,
+		PREDELAY_PARAM,
+		TONE_PARAM,
+		PARAMS_LEN
+	};
+	enum InputId {
+		LEFT_INPUT,
+		RIGHT_INPUT,
+		INPUTS_LEN
+	};
+	enum OutputId {
+		OUTPUTS_LEN
+	};
+	enum LightId {
+		LINK_LIGHT,
+		LIGHTS_LEN
+	};
+
+	// Predelay at the end of the knob, in seconds.
+	static constexpr float MAX_PREDELAY = 0.5f;
+	// Same shelving as the Reverb's tone knob.
+	static constexpr float SHELVING_CENTER = 400.f;
+	static constexpr unsigned CONTROL_PERIOD = 16;
+
+	float FS = 48000.f;
+	ReverbSendMessage messages[2];
+	cs::DelayArena arena;
+	cs::StereoDelayStage predelay;
+	cs::TwoShelves<simd::float_4> tone;
+	unsigned control_phase = 0;
+
+	ReverbSend()
+	: arena(cs::StereoDelayStage::arenaRows(MAX_PREDELAY, FS)),
+	  predelay(MAX_PREDELAY, FS, arena),
+	  tone(FS)
+	{
+		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
+		configParam(LEVEL_PARAM, 0.f, 1.f, 1.f, "Send level", "%", 0.f, 100.f);
+		configParam(PREDELAY_PARAM, 0.f, 1.f, 0.f, "Predelay");
+		configParam(TONE_PARAM, -0.99f, 0.99f, 0.f, "Tone");
+		configInput(LEFT_INPUT, "Left");
+		configInput(RIGHT_INPUT, "Right");
+
+		leftExpander.producerMessage = &messages[0];
+		leftExpander.consumerMessage = &messages[1];
+	}
+
+	void onSampleRateChange(const SampleRateChangeEvent& e) override
+	{
+		if(e.sampleRate == FS){
+			return;
+		}
+		FS = e.sampleRate;
+		arena.reserve(cs::StereoDelayStage::arenaRows(MAX_PREDELAY, FS));
+		arena.reset();
+		predelay = cs::StereoDelayStage(MAX_PREDELAY, FS, arena);
+		tone = cs::TwoShelves<simd::float_4>(FS);
+		control_phase = 0;
+	}
+
+	void process(const ProcessArgs& args) override
+	{
+		if(control_phase == 0){
+			predelay.setScale(dsp::cubic(params[PREDELAY_PARAM].getValue()));
+			float value = params[TONE_PARAM].getValue();
+			float low_gain = value > 0.f ? 1.f - value*value : 1.f;
+			float high_gain = value < 0.f ? 1.f - value*value : 1.f;
+			tone.rampParams(simd::float_4(SHELVING_CENTER), simd::float_4(low_gain), simd::float_4(high_gain), CONTROL_PERIOD);
+		}
+		control_phase = (control_phase + 1 >= CONTROL_PERIOD) ? 0 : control_phase + 1;
+
+		float level = params[LEVEL_PARAM].getValue();
+		float left = inputs[LEFT_INPUT].getVoltageSum();
+		float right = inputs[RIGHT_INPUT].isConnected() ? inputs[RIGHT_INPUT].getVoltageSum() : left;
+		simd::float_4 v = tone.process(predelay.process(level*left, level*right));
+
+		ReverbSendMessage sum;
+		ReverbSendMessage const* upstream = sendChain(this);
+		if(upstream){
+			sum = *upstream;
+		}
+		sum.left += v[0];
+		sum.right += v[1];
+
+		Module* next = rightExpander.module;
+		bool linked = next && (next->model == modelReverbSend || next->model == modelReverb);
+		if(linked){
+			*(ReverbSendMessage*)next->leftExpander.producerMessage = sum;
+			next->leftExpander.requestMessageFlip();
+		}
+		lights[LINK_LIGHT].setBrightness(linked);
+	}
+};
+
+
+struct ReverbSendWidget : ModuleWidget {
+	ReverbSendWidget(ReverbSend* module) {
+		setModule(module);
+		setPanel(createPanel(asset::plugin(pluginInstance, "res/reverb_send.svg")));
+
+		addChild(createLightCentered<MediumLight<WhiteLight>>(mm2px(Vec(10.16, 10.16)), module, ReverbSend::LINK_LIGHT));
+
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 24.13)), module, ReverbSend::LEVEL_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 45.72)), module, ReverbSend::PREDELAY_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(10.16, 60.96)), module, ReverbSend::TONE_PARAM));
+
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(10.16, 83.82)), module, ReverbSend::LEFT_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(10.16, 97.79)), module, ReverbSend::RIGHT_INPUT));
+	}
+};
+
+
+Model* modelReverbSend = createModel<ReverbSend, ReverbSendWidget>("ReverbSend");
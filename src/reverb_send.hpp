@@ -0,0 +1,24 @@
+#pragma once
+#include "plugin.hpp"
+
+// Written by each ReverbSend into the left expander of its right neighbour,
+// another send or the Reverb, once per sample. Every send adds its own
+// signal, so the Reverb receives the sum of the whole chain.
+struct ReverbSendMessage {
+	float left = 0.f;
+	float right = 0.f;
+};
+
+// The message of the send chain ending at the left of `module`, nullptr if there is none.
+inline ReverbSendMessage const* sendChain(Module* module)
+{
+	if(!module->leftExpander.module || module->leftExpander.module->model != modelReverbSend){
+		return nullptr;
+	}
+	return (ReverbSendMessage const*)module->leftExpander.consumerMessage;
+}
+
+// Whether `module`, a Reverb, plays its first network yet. The worker builds
+// it once the module first processes audio, the output is dry until then.
+// For the benchmarks, which only see the Reverb as a Module.
+bool reverbNetworkReady(Module* module);
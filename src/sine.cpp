@@ -1,6 +1,7 @@
 #include "plugin.hpp"
 
 #include "components/bandlimited_oscillator.hpp"
+#include "components/channel_bank.hpp"
 
 using namespace simd;
 
@@ -25,8 +26,8 @@ struct Sine : Module {
 		LIGHTS_LEN
 	};
 
-	dsp::BooleanTrigger reset_trigger[4];
-	cs::Phasor<float_4> osc;
+	dsp::BooleanTrigger reset_trigger[cs::MAX_CHANNELS];
+	cs::ChannelBank<cs::Phasor<float_4>> oscs;
 
 	Sine() {
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
@@ -44,17 +45,23 @@ struct Sine : Module {
 	void process(const ProcessArgs& args) override {
 		unsigned num_channels = std::max<unsigned>(inputs[VPOCT_INPUT].getChannels(), inputs[PHASE_INPUT].getChannels());
 		num_channels = std::max<unsigned>(num_channels, inputs[RESET_INPUT].getChannels());
-		num_channels = std::min<unsigned>(num_channels, 4);
-		outputs[SIGNAL_OUTPUT].setChannels(num_channels);
+		unsigned banks = oscs.setChannels(num_channels);
+		outputs[SIGNAL_OUTPUT].setChannels(oscs.getChannels());
 
+		for(unsigned b = 0; b < banks; b++){
+			processBank(args, oscs[b], 4*b);
+		}
+	}
+
+	void processBank(const ProcessArgs& args, cs::Phasor<float_4>& osc, unsigned c) {
 		float reset[4];
 		for(unsigned i = 0; i < 4; i++){
-			reset[i] = reset_trigger[i].process(inputs[RESET_INPUT].getVoltage(i)) ? 0xFFFFFFFF : 0x00000000;
+			reset[i] = reset_trigger[c + i].process(inputs[RESET_INPUT].getVoltage(c + i)) ? 0xFFFFFFFF : 0x00000000;
 		}
 		float_4 reset_4 = float_4(reset[0], reset[1], reset[2], reset[3]);
 		osc.setPhase(0.f, reset_4);
 
-		float_4 pitch = inputs[VPOCT_INPUT].getPolyVoltageSimd<float_4>(0);
+		float_4 pitch = inputs[VPOCT_INPUT].getPolyVoltageSimd<float_4>(c);
 		float_4 freq = dsp::FREQ_C4 * dsp::approxExp2_taylor5(pitch);
 		freq *= params[RATIO_NUM_PARAM].getValue();
 		freq /= params[RATIO_DEN_PARAM].getValue();
@@ -65,13 +72,13 @@ struct Sine : Module {
 
 		float_4 phase_mod;
 		if(inputs[PHASE_INPUT].isConnected()){
-			phase_mod = inputs[PHASE_INPUT].getPolyVoltageSimd<float_4>(0) * dsp::cubic(params[PHASE_PARAM].getValue());
+			phase_mod = inputs[PHASE_INPUT].getPolyVoltageSimd<float_4>(c) * dsp::cubic(params[PHASE_PARAM].getValue());
 		}
 		else{
 			phase_mod = params[PHASE_PARAM].getValue();
 		}
 
-		outputs[SIGNAL_OUTPUT].setVoltageSimd(5.f*osc.getSineSample(phase_mod), 0);
+		outputs[SIGNAL_OUTPUT].setVoltageSimd(5.f*osc.getSineSample(phase_mod), c);
 	}
 };
 